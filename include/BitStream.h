@@ -0,0 +1,54 @@
+#ifndef CHIPMUNK_BITSTREAM_H
+#define CHIPMUNK_BITSTREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Chipmunk
+{
+    /// Appends values of any bit width to a byte buffer, least significant bit first.
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& buffer);
+
+        /// Write the low @c bits bits of @c value, @c bits must be at most 32.
+        void write(uint32_t value, int bits);
+        /// Write an unsigned value in groups of @c groupBits bits, each followed by a bit saying if more groups follow.
+        void writeVarint(uint32_t value, int groupBits);
+        /// Write a signed value as a varint, small magnitudes of either sign take few bits.
+        void writeSignedVarint(int32_t value, int groupBits);
+
+        /// Number of bits written so far.
+        inline size_t getBitCount() const { return _bits; };
+
+    private:
+        std::vector<uint8_t>& _buffer;
+        size_t _bits;
+    };
+
+    /// Reads values written by a BitWriter. Reading past the end returns zeros and sets the overflow flag.
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t* data, size_t size);
+
+        uint32_t read(int bits);
+        uint32_t readVarint(int groupBits);
+        int32_t readSignedVarint(int groupBits);
+
+        /// True if a read ran past the end of the data.
+        inline bool hasOverflowed() const { return _overflow; };
+        /// Number of bits that can still be read.
+        inline size_t getBitsLeft() const { return _bits < _size*8 ? _size*8 - _bits : 0; };
+
+    private:
+        const uint8_t* _data;
+        size_t _size;
+        size_t _bits;
+        bool _overflow;
+    };
+}
+
+#endif /* CHIPMUNK_BITSTREAM_H */
@@ -17,6 +17,10 @@ namespace Chipmunk
         ~Body();
         operator cpBody*() const;
 
+        /// Create a new body with the same type, mass properties, state and integration functions.
+        /// The copy is not added to any space and has no shapes or constraints attached.
+        std::shared_ptr<Body> clone() const;
+
         /// Wake up a sleeping or idle body.
         inline void activate() { cpBodyActivate(_body); };
         /// Wake up any sleeping or idle bodies touching a static body.
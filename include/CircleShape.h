@@ -10,10 +10,17 @@ namespace Chipmunk
     public:
         CircleShape(std::shared_ptr<Body>, cpFloat radius, cpVect offset = cpv(0, 0));
         
+        std::shared_ptr<Shape> clone(std::shared_ptr<Body> body) const override;
+        
         /// Get the offset of a circle shape.
         inline cpVect getOffset() const { return cpCircleShapeGetOffset(_shape); };
         /// Get the radius of a circle shape.
         inline cpFloat getRadius() const { return cpCircleShapeGetRadius(_shape); };
+        
+        /// Set the offset of a circle shape in place, see Shape::geometryChanged() for @c update.
+        void setOffset(cpVect offset, bool update = true);
+        /// Set the radius of a circle shape in place, see Shape::geometryChanged() for @c update.
+        void setRadius(cpFloat radius, bool update = true);
     };
 }
 
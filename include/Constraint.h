@@ -14,6 +14,11 @@ namespace Chipmunk
         virtual ~Constraint();
         operator cpConstraint*() const;
         
+        /// Create a copy of this constraint with the same parameters connecting @c bodyA and @c bodyB.
+        /// The copy is not added to any space. Subclasses that can't be copied leave the default, which asserts.
+        virtual std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                                  std::shared_ptr<Body> bodyB) const;
+        
         /// Get the first body the constraint is attached to.
         std::shared_ptr<Body> getBodyA() { return _bodyA; }
         /// Get the second body the constraint is attached to.
@@ -60,6 +65,8 @@ namespace Chipmunk
         std::shared_ptr<Body> _bodyB;
         void setBodyA(std::shared_ptr<Body> b);
         void setBodyB(std::shared_ptr<Body> b);
+        /// Copy the force limits, error correction, callbacks and user data of this constraint onto @c constraint.
+        void copyProperties(Constraint& constraint) const;
 
     private:
         Constraint(const Constraint&);
@@ -0,0 +1,81 @@
+#ifndef CHIPMUNK_CUSTOMSHAPE_H
+#define CHIPMUNK_CUSTOMSHAPE_H
+
+#include "Shape.h"
+#include <chipmunk_structs.h>
+#include <vector>
+
+namespace Chipmunk
+{
+    /// Base for shapes built from many convex parts, such as terrain, that sit in the spatial index as one entry.
+    /// Parts are only generated where another shape's bounding box overlaps the custom shape.
+    /// Chipmunk's collision table only covers its own shape types, so a space holding custom shapes is stepped by a
+    /// StepPipeline, which collides each overlapping part with Chipmunk's routines and merges the contacts into one
+    /// arbiter. Custom shapes collide with circles, segments and polygons but not with other custom shapes,
+    /// have no mass, and are meant for static or kinematic bodies.
+    /// @note cpShapesCollide() and cpSpaceShapeQuery() don't know about custom shapes and must not be given one.
+    class CustomShape : public Shape
+    {
+    public:
+        static const int MAX_PART_VERTS = CP_POLY_SHAPE_INLINE_ALLOC;
+
+        /// A convex part of a custom shape, a segment when @c count is 2 and otherwise a polygon
+        /// with counter-clockwise winding.
+        struct Part
+        {
+            /// Identifies the part within its shape, so its contacts are warm started across steps.
+            cpHashValue id;
+            int count;
+            cpVect verts[MAX_PART_VERTS];
+            cpFloat radius;
+            /// Segments in a chain set the endpoints of their neighbours,
+            /// which stops shapes sliding along the chain from catching on the joints.
+            bool hasNeighbors;
+            cpVect prev;
+            cpVect next;
+        };
+
+        /// True if @c shape belongs to a CustomShape.
+        static bool isCustom(const cpShape* shape);
+        /// The CustomShape owning @c shape, which must be custom.
+        static const CustomShape* fromShape(const cpShape* shape);
+
+        /// Collide a regular shape with a custom shape, in either order, the way cpCollide() collides regular shapes.
+        /// Contacts with every overlapping part are reduced to the deepest one and the one furthest from it sharing
+        /// roughly the same normal. Two custom shapes never collide. Safe to call from several threads at once.
+        static struct cpCollisionInfo collide(const cpShape* a, const cpShape* b, cpCollisionID id,
+                                              struct cpContact* contacts);
+
+        /// Append the parts that may overlap @c bb, both in world coordinates. Safe to call from several threads at once.
+        void queryParts(cpBB bb, std::vector<Part>& parts) const;
+
+    protected:
+        explicit CustomShape(std::shared_ptr<Body> body);
+
+        /// Bounding box of the shape in body coordinates.
+        virtual cpBB localBounds() const = 0;
+        /// Append the parts that may overlap @c bb, both in body coordinates. Called from several threads at once.
+        virtual void localParts(cpBB bb, std::vector<Part>& parts) const = 0;
+        /// Segment query in body coordinates, returns false if nothing was hit.
+        /// The default tests every part overlapping the segment's bounding box.
+        virtual bool localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const;
+        /// Nearest point query in body coordinates.
+        /// The default tests the parts in a box around @c p that grows until it holds the nearest part.
+        virtual void localPointQuery(cpVect p, cpPointQueryInfo* info) const;
+
+        /// Query a single part with Chipmunk's own segment and point queries.
+        static bool partSegmentQuery(const Part& part, cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info);
+        static void partPointQuery(const Part& part, cpVect p, cpPointQueryInfo* info);
+
+    private:
+        struct Data;
+        static cpShape* newShape(std::shared_ptr<Body> body);
+        static cpBB shapeCacheData(cpShape* shape, cpTransform transform);
+        static void shapeDestroy(cpShape* shape);
+        static void shapePointQuery(const cpShape* shape, cpVect p, cpPointQueryInfo* info);
+        static void shapeSegmentQuery(const cpShape* shape, cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info);
+        static const cpShapeClass customClass;
+    };
+}
+
+#endif /* CHIPMUNK_CUSTOMSHAPE_H */
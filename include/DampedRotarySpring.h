@@ -15,6 +15,9 @@ namespace Chipmunk
                            cpFloat stiffness,
                            cpFloat damping);
         
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
+        
         /// Get the rest length of the spring.
         inline cpFloat getRestAngle() { return cpDampedRotarySpringGetRestAngle(_constraint); };
         /// Set the rest length of the spring.
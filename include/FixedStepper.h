@@ -0,0 +1,70 @@
+#ifndef CHIPMUNK_FIXEDSTEPPER_H
+#define CHIPMUNK_FIXEDSTEPPER_H
+
+#include <chipmunk.h>
+#include <vector>
+
+namespace Chipmunk
+{
+    class Space;
+    
+    /// Steps a space with a fixed time step from variable frame times and keeps
+    /// the previous and current transform of every body for interpolated rendering.
+    class FixedStepper
+    {
+    public:
+        FixedStepper(Space& space, cpFloat timeStep = 1.0f/60.0f, int maxSteps = 5);
+        
+        /// Length of a single simulation step.
+        inline cpFloat getTimeStep() const { return _timeStep; };
+        inline void setTimeStep(cpFloat timeStep) { _timeStep = timeStep; };
+        
+        /// Maximum number of steps taken by a single call to update().
+        /// Time that would require more steps than this is dropped instead of being carried over,
+        /// so a slow frame can't make every following frame slower. Must be at least 1.
+        inline int getMaxSteps() const { return _maxSteps; };
+        void setMaxSteps(int maxSteps);
+        
+        /// Advance the simulation by @c frameTime, taking as many fixed steps as fit. Returns the number of steps taken.
+        int update(cpFloat frameTime);
+        
+        /// Fraction of a step left over after the last update, suitable as the render alpha.
+        inline cpFloat getAlpha() const { return _accumulator/_timeStep; };
+        
+        /// Calculate the transform of every body blended between the last two steps, in the order of Space::getBodies().
+        /// An @c alpha of 0 gives the state before the last step and 1 gives the current state.
+        const std::vector<cpTransform>& interpolate(cpFloat alpha);
+        /// Interpolate using getAlpha().
+        inline const std::vector<cpTransform>& interpolate() { return interpolate(getAlpha()); };
+        
+        /// Forget the previous transforms so the next interpolation shows the current state.
+        /// Call after teleporting bodies.
+        void reset();
+        
+    private:
+        /// Transforms are stored as separate arrays of components so interpolation runs as one flat loop.
+        struct TransformArrays
+        {
+            std::vector<cpFloat> x, y;
+            std::vector<cpFloat> cos, sin;
+            std::vector<cpFloat> cogX, cogY;
+            
+            void resize(size_t count);
+        };
+        
+        void capture(TransformArrays& arrays);
+        bool bodiesChanged() const;
+        
+        Space& _space;
+        cpFloat _timeStep;
+        int _maxSteps;
+        cpFloat _accumulator;
+        
+        std::vector<cpBody*> _bodies;
+        TransformArrays _previous;
+        TransformArrays _current;
+        std::vector<cpTransform> _transforms;
+    };
+}
+
+#endif /* CHIPMUNK_FIXEDSTEPPER_H */
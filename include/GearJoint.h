@@ -14,6 +14,9 @@ namespace Chipmunk
                   cpFloat phase,
                   cpFloat ratio);
         
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
+        
         /// Get the phase offset of the gears.
         inline cpFloat getPhase() { return cpGearJointGetPhase(_constraint); };
         /// Set the phase offset of the gears.
@@ -15,6 +15,9 @@ namespace Chipmunk
                     cpVect groove_b,
                     cpVect anchorB);
         
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
+        
         /// Get the first endpoint of the groove relative to the first body.
         inline cpVect getGrooveA() { return cpGrooveJointGetGrooveA(_constraint); };
         /// Set the first endpoint of the groove relative to the first body.
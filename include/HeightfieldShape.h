@@ -0,0 +1,68 @@
+#ifndef CHIPMUNK_HEIGHTFIELDSHAPE_H
+#define CHIPMUNK_HEIGHTFIELDSHAPE_H
+
+#include "CustomShape.h"
+#include <vector>
+
+namespace Chipmunk
+{
+    /// Terrain given as heights sampled at regular intervals along the x axis of its body.
+    /// Sample i sits at origin + (i*spacing, heights[i]), and neighbouring samples are joined by segments of the
+    /// given radius. The space sees a single shape, while collisions and queries go straight to the columns they touch.
+    /// Like segments the surface is solid from both sides, so bodies must not be allowed to pass below it.
+    class HeightfieldShape : public CustomShape
+    {
+    public:
+        /// @c heights needs at least two samples and @c spacing must be positive.
+        HeightfieldShape(std::shared_ptr<Body>,
+                         const std::vector<cpFloat>& heights,
+                         cpFloat spacing,
+                         cpVect origin = cpv(0, 0),
+                         cpFloat radius = 0.0f);
+
+        std::shared_ptr<Shape> clone(std::shared_ptr<Body> body) const override;
+
+        /// Split a long heightfield into shapes of at most @c columns columns each, for a few smaller entries
+        /// in the spatial index. Neighbouring chunks share their edge samples and join without seams.
+        static std::vector<std::shared_ptr<HeightfieldShape>> createChunks(std::shared_ptr<Body>,
+                                                                           const std::vector<cpFloat>& heights,
+                                                                           cpFloat spacing,
+                                                                           size_t columns,
+                                                                           cpVect origin = cpv(0, 0),
+                                                                           cpFloat radius = 0.0f);
+
+        inline const std::vector<cpFloat>& getHeights() const { return _heights; };
+        inline cpFloat getSpacing() const { return _spacing; };
+        inline cpVect getOrigin() const { return _origin; };
+        inline cpFloat getRadius() const { return _radius; };
+
+        /// Height of the surface at @c x in body coordinates, clamped to the ends of the heightfield.
+        cpFloat heightAt(cpFloat x) const;
+
+    protected:
+        cpBB localBounds() const override;
+        void localParts(cpBB bb, std::vector<Part>& parts) const override;
+        bool localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const override;
+        void localPointQuery(cpVect p, cpPointQueryInfo* info) const override;
+
+    private:
+        int columnCount() const;
+        int columnAt(cpFloat x) const;
+        cpVect sample(int i) const;
+        void columnPart(int column, Part& part) const;
+
+        std::vector<cpFloat> _heights;
+        cpFloat _spacing;
+        cpVect _origin;
+        cpFloat _radius;
+        cpFloat _minHeight;
+        cpFloat _maxHeight;
+        /// Heights of the samples just past either end when the heightfield is one chunk of a longer one.
+        bool _hasPrev;
+        bool _hasNext;
+        cpFloat _prevHeight;
+        cpFloat _nextHeight;
+    };
+}
+
+#endif /* CHIPMUNK_HEIGHTFIELDSHAPE_H */
@@ -0,0 +1,75 @@
+#ifndef CHIPMUNK_INTERESTMANAGER_H
+#define CHIPMUNK_INTERESTMANAGER_H
+
+#include <chipmunk.h>
+#include <memory>
+#include <vector>
+
+namespace Chipmunk
+{
+    class Body;
+    class Space;
+
+    /// Finds the bodies inside the area of interest of many clients at once.
+    /// Every update makes a single pass over the bodies of the space, bins their bounding boxes into a
+    /// uniform grid and then gathers each client's bodies from the grid cells its area covers.
+    /// Clients are processed in parallel on the space's scheduler if it has one.
+    /// Static bodies are never reported.
+    class InterestManager
+    {
+    public:
+        explicit InterestManager(const Space& space);
+
+        /// Size of the grid cells. Defaults to 0, which uses the average size of the client areas.
+        inline cpFloat getCellSize() const { return _cellSize; };
+        inline void setCellSize(cpFloat cellSize) { _cellSize = cellSize; };
+
+        /// Find the bodies inside @c areas, one area per client. Clients keep their index between updates.
+        void update(const std::vector<cpBB>& areas);
+
+        inline size_t getClientCount() const { return _clients.size(); };
+        /// Bodies inside the client's area, sorted by address.
+        /// The manager holds on to them until the next update, so a body removed from the space and a new body
+        /// allocated in its place never compare equal.
+        inline const std::vector<std::shared_ptr<Body>>& getBodies(size_t client) const { return _clients[client].bodies; };
+        /// Bodies that are inside the client's area now but weren't in the previous update.
+        inline const std::vector<std::shared_ptr<Body>>& getEntered(size_t client) const { return _clients[client].entered; };
+        /// Bodies that were inside the client's area in the previous update but aren't now,
+        /// including bodies that have been removed from the space since.
+        inline const std::vector<std::shared_ptr<Body>>& getLeft(size_t client) const { return _clients[client].left; };
+
+    private:
+        struct Entry
+        {
+            cpBB bb;
+            std::shared_ptr<Body> body;
+        };
+
+        struct Client
+        {
+            std::vector<std::shared_ptr<Body>> bodies;
+            std::vector<std::shared_ptr<Body>> previous;
+            std::vector<std::shared_ptr<Body>> entered;
+            std::vector<std::shared_ptr<Body>> left;
+        };
+
+        void gatherEntries(cpBB bounds);
+        void buildGrid(const std::vector<cpBB>& areas);
+        void updateClient(Client& client, cpBB area) const;
+        void cellRange(cpBB bb, int& x0, int& y0, int& x1, int& y1) const;
+
+        const Space& _space;
+        cpFloat _cellSize;
+
+        std::vector<Entry> _entries;
+        cpBB _gridBounds;
+        cpFloat _gridCellSize;
+        int _columns;
+        int _rows;
+        std::vector<unsigned> _cellStarts;
+        std::vector<unsigned> _cellEntries;
+        std::vector<Client> _clients;
+    };
+}
+
+#endif /* CHIPMUNK_INTERESTMANAGER_H */
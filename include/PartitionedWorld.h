@@ -0,0 +1,123 @@
+#ifndef CHIPMUNK_PARTITIONEDWORLD_H
+#define CHIPMUNK_PARTITIONEDWORLD_H
+
+#include <chipmunk.h>
+#include "LayerMask.h"
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Chipmunk
+{
+    class Body;
+    class Shape;
+    class Space;
+    class TaskScheduler;
+
+    /// A large world split into square regions, each simulated by its own Space.
+    /// Regions are created on demand, stepped in parallel on a TaskScheduler and freed again after a step
+    /// once no body lives in them or reaches into them, so only the regions in use are kept.
+    /// A body lives in the region that contains its position and moves to another region when it crosses a seam.
+    /// Where a body's bounding box comes within the ghost margin of a neighbouring region, a kinematic ghost copy
+    /// of it is kept in that region so bodies on both sides of a seam collide.
+    /// Ghosts are always static or kinematic, and each side resolves the contact against the other side's ghost as
+    /// if it had infinite mass. Seam contacts are therefore not momentum-conserving: both bodies are pushed apart in
+    /// full and can gain energy, most visibly when heavy and light bodies meet at a seam.
+    /// Constraints between bodies are not managed and must stay inside one region.
+    class PartitionedWorld
+    {
+    public:
+        typedef std::pair<int, int> RegionKey;
+
+        /// Create a world of @c regionSize by @c regionSize regions, stepped in parallel on @c scheduler if given.
+        explicit PartitionedWorld(cpFloat regionSize, std::shared_ptr<TaskScheduler> scheduler = nullptr);
+        ~PartitionedWorld();
+
+        inline cpFloat getRegionSize() const { return _regionSize; };
+
+        /// Distance from a region within which bodies get a ghost in it.
+        /// Should be at least the size of the largest body. Defaults to an eighth of the region size.
+        inline cpFloat getGhostMargin() const { return _ghostMargin; };
+        inline void setGhostMargin(cpFloat margin) { _ghostMargin = margin; };
+
+        /// Called for every region, now and when new regions are created, to set gravity, iterations and so on.
+        void configure(std::function<void(Space&)> func);
+
+        /// Add a body and the shapes attached to it.
+        /// Static bodies are added to every region their shapes overlap instead of moving between regions.
+        void add(std::shared_ptr<Body> body, const std::vector<std::shared_ptr<Shape>>& shapes);
+        /// Remove a body, its shapes and its ghosts.
+        void remove(std::shared_ptr<Body> body);
+
+        /// Step every region by @c dt, then move bodies that crossed a seam and update ghosts.
+        void step(cpFloat dt);
+
+        /// The key of the region containing @c p.
+        RegionKey regionKeyFor(cpVect p) const;
+        /// The region containing @c p, created if it doesn't exist yet.
+        /// A region is kept while it holds bodies added to it directly, otherwise it may be freed by the next step().
+        Space& getRegion(cpVect p);
+        inline size_t getRegionCount() const { return _regions.size(); };
+        /// Number of bodies added to the world, not counting ghosts.
+        inline size_t getBodyCount() const { return _entries.size(); };
+
+        /// Query the regions within @c maxDistance of @c p and return the nearest shape found, NULL if none was found.
+        std::shared_ptr<Shape> pointQueryNearest(cpVect p, LayerMask, cpGroup, cpFloat maxDistance = 100.0f) const;
+        /// Query the regions the segment passes through and return the first shape hit, NULL if none was hit.
+        /// Ghosts are never returned, a hit on a ghost returns the shape it copies.
+        std::shared_ptr<Shape> segmentQueryFirst(cpVect a, cpVect b, cpFloat radius, LayerMask, cpGroup,
+                                                 cpSegmentQueryInfo* = nullptr) const;
+        inline std::shared_ptr<Shape> segmentQueryFirst(cpVect a, cpVect b, LayerMask layers, cpGroup group,
+                                                        cpSegmentQueryInfo* info = nullptr) const
+        { return segmentQueryFirst(a, b, 0.0f, layers, group, info); };
+
+    private:
+        PartitionedWorld(const PartitionedWorld&);
+        const PartitionedWorld& operator=(const PartitionedWorld&);
+
+        struct Ghost
+        {
+            RegionKey key;
+            std::shared_ptr<Body> body;
+            std::vector<std::shared_ptr<Shape>> shapes;
+        };
+
+        struct Entry
+        {
+            std::shared_ptr<Body> body;
+            std::vector<std::shared_ptr<Shape>> shapes;
+            RegionKey home;
+            bool isStatic;
+            std::vector<Ghost> ghosts;
+        };
+
+        Space* findRegion(const RegionKey& key) const;
+        Space& regionFor(const RegionKey& key);
+        cpBB boundsFor(const Entry& entry) const;
+        void regionKeysFor(cpBB bb, std::vector<RegionKey>& keys) const;
+        void addGhost(Entry& entry, const RegionKey& key);
+        void removeGhost(Ghost& ghost);
+        void updateGhosts(Entry& entry);
+        void migrate(Entry& entry);
+        void trimRegions();
+        std::shared_ptr<Shape> ownerOf(const std::shared_ptr<Shape>& shape) const;
+
+        cpFloat _regionSize;
+        cpFloat _ghostMargin;
+        std::shared_ptr<TaskScheduler> _scheduler;
+        std::vector<std::function<void(Space&)>> _configure;
+
+        std::map<RegionKey, std::unique_ptr<Space>> _regions;
+        std::vector<Space*> _stepList;
+        std::vector<std::unique_ptr<Entry>> _entries;
+        std::unordered_map<Body*, size_t> _entryIndices;
+        /// Maps the shapes of ghosts to the shapes they copy.
+        std::unordered_map<Shape*, std::shared_ptr<Shape>> _ghostOwners;
+        std::vector<RegionKey> _keys;
+    };
+}
+
+#endif /* CHIPMUNK_PARTITIONEDWORLD_H */
@@ -14,6 +14,9 @@ namespace Chipmunk
                  cpVect anchorA,
                  cpVect anchorB);
         
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
+        
         /// Get the location of the first anchor relative to the first body.
         inline cpVect getAnchorA() { return cpPinJointGetAnchorA(_constraint); }
         /// Set the location of the first anchor relative to the first body.
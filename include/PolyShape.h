@@ -2,14 +2,49 @@
 #define CHIPMUNK_POLYSHAPE_H
 
 #include "Shape.h"
+#include "Body.h"
+#include <iterator>
 #include <vector>
 
 namespace Chipmunk
 {
+    class PolyShapeTemplate;
+
     class PolyShape : public Shape
     {
     public:
+        /// Create a polygon from verts that already form a counter-clockwise convex hull.
         PolyShape(std::shared_ptr<Body>, const std::vector<cpVect>& verts);
+        /// Create a polygon from the convex hull of @c count verts after applying @c transform to them.
+        /// Verts closer than @c tolerance to the hull are dropped, and the polygon is rounded by @c radius.
+        PolyShape(std::shared_ptr<Body>,
+                  const cpVect* verts,
+                  int count,
+                  cpTransform transform = cpTransformIdentity,
+                  cpFloat radius = 0.0f,
+                  cpFloat tolerance = 0.0f);
+        /// Create a polygon from the convex hull of a range of verts, such as those of a std::array or std::list.
+        template <typename Iterator>
+        PolyShape(std::shared_ptr<Body> body,
+                  Iterator first,
+                  Iterator last,
+                  cpTransform transform = cpTransformIdentity,
+                  cpFloat radius = 0.0f,
+                  cpFloat tolerance = 0.0f) :
+        Shape(newHull(body ? (*body) : (cpBody*)0, first, last, transform, radius, tolerance), body)
+        { }
+        /// Create an instance of a shared polygon, much cheaper than building it from its verts.
+        /// The vertex count of an instance must not be changed through chipmunk_unsafe.h.
+        PolyShape(std::shared_ptr<Body>, std::shared_ptr<const PolyShapeTemplate>);
+        
+        std::shared_ptr<Shape> clone(std::shared_ptr<Body> body) const override;
+        
+        /// Create a box centered on the body, grown on all sides by @c radius.
+        static std::shared_ptr<PolyShape> createBox(std::shared_ptr<Body>, cpFloat width, cpFloat height, cpFloat radius = 0.0f);
+        /// Create a box covering @c box in body coordinates, grown on all sides by @c radius.
+        static std::shared_ptr<PolyShape> createBox(std::shared_ptr<Body>, cpBB box, cpFloat radius = 0.0f);
+        /// Create a box of exactly @c width by @c height centered on the body, with corners rounded by @c radius.
+        static std::shared_ptr<PolyShape> createRoundedBox(std::shared_ptr<Body>, cpFloat width, cpFloat height, cpFloat radius);
         
         /// Get the number of verts in a polygon shape.
         int getCount() const { return cpPolyShapeGetCount(_shape); };
@@ -17,7 +52,47 @@ namespace Chipmunk
         cpVect getVert(int i) { return cpPolyShapeGetVert(_shape, i); };
         /// Get the radius of a polygon shape.
         cpFloat getRadius() { return cpPolyShapeGetRadius(_shape); };
+        /// Replace the verts of a polygon shape in place with the convex hull of @c verts after applying @c transform,
+        /// see Shape::geometryChanged() for @c update. Template instances must keep their vertex count,
+        /// and no longer refer to their template afterwards.
+        void setVerts(const cpVect* verts, int count, cpTransform transform = cpTransformIdentity, bool update = true);
+        /// Set the radius of a polygon shape in place, see Shape::geometryChanged() for @c update.
+        /// Template instances no longer refer to their template afterwards.
+        void setRadius(cpFloat radius, bool update = true);
+        /// Get the template this shape was created from, if any.
+        inline std::shared_ptr<const PolyShapeTemplate> getTemplate() const { return _template; };
+        
+    protected:
+        PolyShape(cpShape*, std::shared_ptr<Body>);
+        
+    private:
+        template <typename Iterator>
+        static cpShape* newHull(cpBody*, Iterator first, Iterator last, cpTransform, cpFloat radius, cpFloat tolerance);
+        static cpShape* newHullInPlace(cpBody*, cpVect* verts, int count, cpFloat radius, cpFloat tolerance);
+        /// Room for @c count verts owned by the calling thread, valid until its next call on that thread.
+        static cpVect* scratchVerts(int count);
+        
+        std::shared_ptr<const PolyShapeTemplate> _template;
     };
+    
+    template <typename Iterator>
+    cpShape* PolyShape::newHull(cpBody* body,
+                                Iterator first,
+                                Iterator last,
+                                cpTransform transform,
+                                cpFloat radius,
+                                cpFloat tolerance)
+    {
+        int count = static_cast<int>(std::distance(first, last));
+        cpAssertHard(count >= 1, "A polygon needs at least one vert.");
+        // Copied one by one, the range doesn't have to be contiguous.
+        cpVect* hull = scratchVerts(count);
+        for (int i = 0; i < count; i++, ++first)
+        {
+            hull[i] = cpTransformPoint(transform, *first);
+        }
+        return newHullInPlace(body, hull, count, radius, tolerance);
+    }
 }
 
 #endif /* CHIPMUNK_POLYSHAPE_H */
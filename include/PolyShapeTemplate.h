@@ -0,0 +1,46 @@
+#ifndef CHIPMUNK_POLYSHAPETEMPLATE_H
+#define CHIPMUNK_POLYSHAPETEMPLATE_H
+
+#include <chipmunk.h>
+#include <memory>
+#include <vector>
+
+namespace Chipmunk
+{
+    class PolyShape;
+
+    /// The hull, splitting planes, area, moment and centroid of a polygon, computed once for many PolyShape instances.
+    /// Creating an instance from a template only copies its planes, and the instance is allocated with room for
+    /// exactly its own planes rather than Chipmunk's fixed inline storage.
+    class PolyShapeTemplate
+    {
+    public:
+        /// @c verts are in body coordinates and may be in any order, their convex hull is used.
+        PolyShapeTemplate(const std::vector<cpVect>& verts, cpFloat radius = 0.0f);
+        ~PolyShapeTemplate();
+
+        /// Get the number of verts in the hull.
+        inline int getCount() const { return cpPolyShapeGetCount(_prototype); };
+        /// Get the @c ith vertex of the hull.
+        inline cpVect getVert(int i) const { return cpPolyShapeGetVert(_prototype, i); };
+        /// Get the radius of the polygon.
+        inline cpFloat getRadius() const { return cpPolyShapeGetRadius(_prototype); };
+        /// Get the area of the polygon.
+        inline cpFloat getArea() const { return cpShapeGetArea(_prototype); };
+        /// Get the centroid of the polygon.
+        inline cpVect getCenterOfGravity() const { return cpShapeGetCenterOfGravity(_prototype); };
+
+    private:
+        friend class PolyShape;
+        /// Allocate a polygon shape attached to @c body with this template's geometry.
+        cpShape* newShape(cpBody* body) const;
+
+        /// Never attached to a body or space, instances copy its class, mass information and planes.
+        cpShape* _prototype;
+
+        PolyShapeTemplate(const PolyShapeTemplate&);
+        const PolyShapeTemplate& operator=(const PolyShapeTemplate&);
+    };
+}
+
+#endif /* CHIPMUNK_POLYSHAPETEMPLATE_H */
@@ -14,6 +14,9 @@ namespace Chipmunk
                      cpFloat phase,
                      cpFloat ratchet);
         
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
+        
         /// Get the angle of the current ratchet tooth.
         inline cpFloat getAngle() { return cpRatchetJointGetAngle(_constraint); };
         /// Set the angle of the current ratchet tooth.
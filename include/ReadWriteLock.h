@@ -0,0 +1,65 @@
+#ifndef CHIPMUNK_READWRITELOCK_H
+#define CHIPMUNK_READWRITELOCK_H
+
+#include <atomic>
+#include <thread>
+
+namespace Chipmunk
+{
+    /// Lets any number of readers in at once, or a single writer.
+    /// The writer may lock again and may take read locks while it holds the write lock,
+    /// so queries from inside collision callbacks and nested adds during a step don't deadlock.
+    /// Waiting writers hold back new readers, so a steady stream of queries can't starve a writer.
+    /// Threads that already hold a read lock are still let in, so nested read locks don't deadlock.
+    /// A thread holding a read lock must not take the write lock, it would wait for itself forever.
+    class ReadWriteLock
+    {
+    public:
+        ReadWriteLock();
+        
+        void lockShared();
+        void unlockShared();
+        
+        void lock();
+        void unlock();
+        
+        /// Scoped shared lock.
+        class ReadGuard
+        {
+        public:
+            explicit ReadGuard(ReadWriteLock& lock) : _lock(lock) { _lock.lockShared(); };
+            ~ReadGuard() { _lock.unlockShared(); };
+        private:
+            ReadGuard(const ReadGuard&);
+            const ReadGuard& operator=(const ReadGuard&);
+            ReadWriteLock& _lock;
+        };
+        
+        /// Scoped exclusive lock.
+        class WriteGuard
+        {
+        public:
+            explicit WriteGuard(ReadWriteLock& lock) : _lock(lock) { _lock.lock(); };
+            ~WriteGuard() { _lock.unlock(); };
+        private:
+            WriteGuard(const WriteGuard&);
+            const WriteGuard& operator=(const WriteGuard&);
+            ReadWriteLock& _lock;
+        };
+        
+    private:
+        ReadWriteLock(const ReadWriteLock&);
+        const ReadWriteLock& operator=(const ReadWriteLock&);
+        
+        bool isWriter() const;
+        
+        /// Number of readers, or -1 while a writer holds the lock.
+        std::atomic<int> _state;
+        std::atomic<std::thread::id> _writer;
+        int _writeDepth;
+        /// Number of threads waiting in lock().
+        std::atomic<int> _waitingWriters;
+    };
+}
+
+#endif /* CHIPMUNK_READWRITELOCK_H */
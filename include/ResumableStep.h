@@ -0,0 +1,64 @@
+#ifndef CHIPMUNK_RESUMABLESTEP_H
+#define CHIPMUNK_RESUMABLESTEP_H
+
+#include <chipmunk.h>
+#include "StepPipeline.h"
+
+namespace Chipmunk
+{
+    class Space;
+
+    /// Steps a space one phase at a time so a step can be spread over several idle slots of a frame.
+    /// Every call to advance() runs a single phase and returns, no thread is kept waiting in between.
+    /// Phases may be advanced from different threads as long as only one thread advances at a time.
+    /// The space stays locked from start() until the step is finished, adding or removing objects directly or
+    /// stepping the space in the meantime asserts, use the Space::enqueue*() functions to change it instead.
+    /// Queries can run between phases and see the partially stepped state.
+    class ResumableStep
+    {
+    public:
+        enum Phase
+        {
+            /// No step is in progress.
+            IDLE,
+            INTEGRATE,
+            BROADPHASE,
+            NARROWPHASE,
+            /// Sleeping, stale contacts, pre step, velocity integration and warm starting.
+            PREPARE,
+            /// One solver iteration per advance().
+            SOLVE,
+            /// Post solve and post-step callbacks.
+            CALLBACKS,
+        };
+
+        explicit ResumableStep(Space& space);
+        /// Finishes a step that is still in progress.
+        ~ResumableStep();
+
+        /// Start stepping the space forward by @c dt. Queued commands are applied first.
+        /// Returns false if the step has nothing to do, @c dt is 0, in which case it is already finished.
+        bool start(cpFloat dt);
+        /// Run the next phase. Returns true while phases remain.
+        bool advance();
+        /// Run every remaining phase.
+        void finish();
+
+        /// The phase the next advance() runs.
+        inline Phase getPhase() const { return _phase; };
+        inline bool isRunning() const { return _phase != IDLE; };
+        /// Solver iterations still to run in this step.
+        inline int getRemainingIterations() const { return _iterations; };
+
+    private:
+        ResumableStep(const ResumableStep&);
+        const ResumableStep& operator=(const ResumableStep&);
+
+        Space& _space;
+        StepPipeline _pipeline;
+        Phase _phase;
+        int _iterations;
+    };
+}
+
+#endif /* CHIPMUNK_RESUMABLESTEP_H */
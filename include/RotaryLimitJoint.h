@@ -13,6 +13,9 @@ namespace Chipmunk
                          std::shared_ptr<Body> bodyB,
                          cpFloat min,
                          cpFloat max);
+        
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
 
         /// Get the minimum distance the joint will maintain between the two anchors.
         inline cpFloat getMin() { return cpRotaryLimitJointGetMin(_constraint); };
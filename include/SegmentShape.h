@@ -15,6 +15,8 @@ namespace Chipmunk
                      cpVect b,
                      cpFloat radius);
         
+        std::shared_ptr<Shape> clone(std::shared_ptr<Body> body) const override;
+        
         /// Let Chipmunk know about the geometry of adjacent segments to avoid colliding with endcaps.
         void setNeighbors(std::shared_ptr<Shape> shape, cpVect prev, cpVect next);
         
@@ -26,6 +28,11 @@ namespace Chipmunk
         cpVect getNormal(const std::shared_ptr<Shape> shape);
         /// Get the first endpoint of a segment shape.
         cpFloat getRadius(const std::shared_ptr<Shape> shape);
+        
+        /// Set the endpoints of a segment shape in place, see Shape::geometryChanged() for @c update.
+        void setEndpoints(cpVect a, cpVect b, bool update = true);
+        /// Set the radius of a segment shape in place, see Shape::geometryChanged() for @c update.
+        void setRadius(cpFloat radius, bool update = true);
     };
 }
 
@@ -0,0 +1,18 @@
+#ifndef CHIPMUNK_SERIALSCHEDULER_H
+#define CHIPMUNK_SERIALSCHEDULER_H
+
+#include "TaskScheduler.h"
+
+namespace Chipmunk
+{
+    /// Runs every range on the calling thread in order, so stepping gives the same result on every machine.
+    class SerialScheduler : public TaskScheduler
+    {
+    public:
+        virtual unsigned getThreadCount() const;
+        virtual void parallelFor(size_t count, size_t grain, std::function<void(size_t begin, size_t end)> func);
+        virtual void wait();
+    };
+}
+
+#endif /* CHIPMUNK_SERIALSCHEDULER_H */
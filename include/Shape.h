@@ -16,6 +16,10 @@ namespace Chipmunk
         virtual ~Shape();
         operator cpShape*() const;
         
+        /// Create a copy of this shape with the same geometry and surface properties attached to @c body.
+        /// The copy is not added to any space. Subclasses that can't be copied leave the default, which asserts.
+        virtual std::shared_ptr<Shape> clone(std::shared_ptr<Body> body) const;
+        
         /// Update, cache and return the bounding box of a shape based on the body it's attached to.
         BoundingBox cacheBoundingBox();
         /// Update, cache and return the bounding box of a shape with an explicit transformation.
@@ -26,11 +30,12 @@ namespace Chipmunk
         bool pointQuery(cpVect) const;
 
         /// Perform a segment query against a shape. @c info must be a pointer to a valid cpSegmentQueryInfo structure.
-        bool segmentQuery(cpVect a, cpVect b, cpSegmentQueryInfo* = nullptr);
+        inline bool segmentQuery(cpVect a, cpVect b, cpSegmentQueryInfo* info = nullptr) { return segmentQuery(a, b, 0.0f, info); };
+        /// Perform a segment query with a thickness, the segment is swept by a circle of @c radius.
+        bool segmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* = nullptr);
 
-        /// Return contact information about two shapes.
-        cpContactPointSet shapesCollide(std::shared_ptr<Shape> shapeA,
-                                        std::shared_ptr<Shape> shapeB) { return cpShapesCollide(*shapeA, *shapeB); };
+        /// Return contact information about two shapes. Custom shapes aren't supported.
+        cpContactPointSet shapesCollide(std::shared_ptr<Shape> shapeA, std::shared_ptr<Shape> shapeB);
         
         /// The cpBody this shape is connected to.
         inline std::shared_ptr<Body> getBody() { return _body; };
@@ -41,12 +46,13 @@ namespace Chipmunk
         /// Get the mass of the shape if you are having Chipmunk calculate mass properties for you.
         inline cpFloat getMass() { return cpShapeGetMass(_shape); };
         /// Set the mass of this shape to have Chipmunk calculate mass properties for you.
-        inline void setMass(cpFloat mass) { cpShapeSetMass(_shape, mass); };
+        inline void setMass(cpFloat mass) { _density = 0.0f; cpShapeSetMass(_shape, mass); };
 
         /// Get the density of the shape if you are having Chipmunk calculate mass properties for you.
         inline cpFloat getDensity() { return cpShapeGetDensity(_shape); };
         /// Set the density  of this shape to have Chipmunk calculate mass properties for you.
-        inline void setDensity(cpFloat density) { cpShapeSetDensity(_shape, density); };
+        /// The mass then follows the area when the geometry is changed in place.
+        inline void setDensity(cpFloat density) { _density = density; cpShapeSetDensity(_shape, density); };
 
         /// Get the calculated moment of inertia for this shape.
         inline cpFloat getMoment() { return cpShapeGetMoment(_shape); };
@@ -57,6 +63,14 @@ namespace Chipmunk
 
         /// Get the bounding box that contains the shape given it's current position and angle.
         BoundingBox getBoundingBox();
+        
+        /// Update the mass, bounding box and spatial index entry after the geometry was changed in place.
+        /// The geometry setters of the shape classes call this unless their @c update argument is false,
+        /// pass false when animating many shapes and hand them all to Space::updateMorphedShapes() instead.
+        /// Doesn't take the space's lock, so don't call it while other threads may query the space.
+        void geometryChanged();
+        /// Recompute the mass of a shape with a density from its new area, part of geometryChanged().
+        void updateMass();
 
         /// Get if the shape is set to be a sensor or not.
         inline cpBool getSensor() { return cpShapeGetSensor(_shape); };
@@ -95,9 +109,13 @@ namespace Chipmunk
         
     protected:
         Shape(cpShape*, std::shared_ptr<Body>);
+        /// Copy the mass, material, filtering and user data of this shape onto @c shape.
+        void copyProperties(Shape& shape) const;
         cpShape* _shape;
         
         std::shared_ptr<Body> _body;
+        /// Density set with setDensity(), 0 when the mass was set directly.
+        cpFloat _density;
     private:
         Shape(const Shape&);
         const Shape& operator=(const Shape&);
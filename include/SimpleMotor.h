@@ -13,6 +13,9 @@ namespace Chipmunk
                     std::shared_ptr<Body> bodyB,
                     cpFloat rate);
         
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
+        
         /// Get the rate of the motor.
         inline cpFloat getRate() { return cpSimpleMotorGetRate(_constraint); };
         /// Set the rate of the motor.
@@ -16,6 +16,9 @@ namespace Chipmunk
                    cpFloat min,
                    cpFloat max);
         
+        std::shared_ptr<Constraint> clone(std::shared_ptr<Body> bodyA,
+                                          std::shared_ptr<Body> bodyB) const override;
+        
         /// Get the location of the first anchor relative to the first body.
         inline cpVect getAnchorA() { return cpSlideJointGetAnchorA(_constraint); };
         /// Set the location of the first anchor relative to the first body.
@@ -0,0 +1,112 @@
+#ifndef CHIPMUNK_SNAPSHOT_H
+#define CHIPMUNK_SNAPSHOT_H
+
+#include <chipmunk.h>
+#include <cstdint>
+#include <vector>
+
+namespace Chipmunk
+{
+    class Space;
+
+    /// Quantization used by SnapshotEncoder and SnapshotDecoder, both ends must use the same settings.
+    struct SnapshotSettings
+    {
+        SnapshotSettings();
+
+        /// Smallest position step that is replicated. Defaults to 1/64.
+        cpFloat positionPrecision;
+        /// Smallest velocity step that is replicated. Defaults to 1/64.
+        cpFloat velocityPrecision;
+        /// Smallest angular velocity step that is replicated. Defaults to 1/256.
+        cpFloat angularVelocityPrecision;
+        /// Bits used for a full turn of the angle, from 1 to 32. Defaults to 12.
+        int angleBits;
+        /// Number of past snapshots kept as possible baselines. Defaults to 32.
+        unsigned historySize;
+        /// Most bodies a snapshot may hold, larger snapshots are rejected by the decoder. Defaults to 65536.
+        unsigned maxBodies;
+    };
+
+    /// Quantized state of every body in a space at one point in time.
+    struct SnapshotFrame
+    {
+        enum Field
+        {
+            POSITION_X,
+            POSITION_Y,
+            ANGLE,
+            VELOCITY_X,
+            VELOCITY_Y,
+            ANGULAR_VELOCITY,
+            FIELD_COUNT
+        };
+
+        struct Body
+        {
+            int32_t values[FIELD_COUNT];
+        };
+
+        uint32_t sequence;
+        std::vector<Body> bodies;
+    };
+
+    /// Encodes the bodies of a space for replication to clients.
+    /// Bodies are identified by their index in Space::getBodies(), so clients must add the same bodies in the same order.
+    /// Every snapshot is delta encoded against the last snapshot the client acknowledged, and bodies whose
+    /// quantized state hasn't changed since then, sleeping bodies included, are left out entirely.
+    class SnapshotEncoder
+    {
+    public:
+        /// Baseline for clients that haven't acknowledged any snapshot yet.
+        static const uint32_t NO_BASELINE = 0xffffffffu;
+
+        explicit SnapshotEncoder(const Space& space, const SnapshotSettings& settings = SnapshotSettings());
+
+        /// Quantize the current state of the space as a new snapshot and return its sequence number.
+        /// Call once per network tick, then encode() once per client.
+        uint32_t capture();
+
+        /// Append the latest capture to @c out, delta encoded against @c baseline.
+        /// Returns false if the baseline is no longer kept, in which case a full snapshot is written instead.
+        bool encode(uint32_t baseline, std::vector<uint8_t>& out) const;
+
+        /// Sequence number of the latest capture.
+        inline uint32_t getSequence() const { return _sequence; };
+
+    private:
+        const SnapshotFrame* findFrame(uint32_t sequence) const;
+
+        const Space& _space;
+        SnapshotSettings _settings;
+        std::vector<SnapshotFrame> _history;
+        uint32_t _sequence;
+    };
+
+    /// Applies snapshots written by a SnapshotEncoder to the matching bodies of a client space.
+    class SnapshotDecoder
+    {
+    public:
+        explicit SnapshotDecoder(Space& space, const SnapshotSettings& settings = SnapshotSettings());
+
+        /// Decode a snapshot and apply the bodies that changed.
+        /// Snapshots older than the newest one decoded are kept as baselines but not applied.
+        /// Returns false without applying anything if the data is malformed or its baseline is unknown.
+        bool decode(const uint8_t* data, size_t size);
+
+        /// Sequence number of the newest snapshot decoded, send it to the server as the client's baseline.
+        inline uint32_t getAcknowledged() const { return _acknowledged; };
+
+    private:
+        const SnapshotFrame* findFrame(uint32_t sequence) const;
+        void apply(const SnapshotFrame& frame);
+
+        Space& _space;
+        SnapshotSettings _settings;
+        std::vector<SnapshotFrame> _history;
+        SnapshotFrame _applied;
+        uint32_t _acknowledged;
+    };
+}
+
+#endif /* CHIPMUNK_SNAPSHOT_H */
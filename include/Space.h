@@ -3,10 +3,15 @@
 
 #include <chipmunk.h>
 #include "LayerMask.h"
+#include "ReadWriteLock.h"
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace Chipmunk
 {
@@ -15,9 +20,86 @@ namespace Chipmunk
 
     class Constraint;
     class Shape;
+    class TaskScheduler;
+    class StepPipeline;
     
     typedef std::function<void(std::shared_ptr<Shape>, cpFloat, cpVect)> SegmentQueryFunc;
     
+    /// Integrated state of a single body, used to compare two runs of the same simulation.
+    struct BodyState
+    {
+        cpVect position;
+        cpVect velocity;
+        cpFloat angle;
+        cpFloat angularVelocity;
+    };
+    
+    /// A shape hit by a segment query.
+    /// The shape pointer is only guaranteed to stay valid while the space's lock is held.
+    struct SegmentQueryHit
+    {
+        /// The shape that was hit, null if nothing was hit.
+        Shape* shape;
+        cpVect point;
+        cpVect normal;
+        /// Normalized distance along the query segment in the range [0, 1].
+        cpFloat alpha;
+    };
+    
+    /// Solver settings chosen by Space::stepWithBudget() and the time the step took.
+    struct StepQuality
+    {
+        /// 0 is full quality, each level above roughly halves the solver work.
+        int level;
+        int iterations;
+        int substeps;
+        cpTimestamp collisionPersistence;
+        /// Measured duration of the whole step in microseconds.
+        int64_t microseconds;
+    };
+    
+    /// Level of detail tiers, from full rate stepping to forced sleep.
+    enum LodTier
+    {
+        LOD_FULL,
+        LOD_HALF,
+        LOD_QUARTER,
+        LOD_ASLEEP,
+        LOD_TIER_COUNT
+    };
+    
+    /// Number of bodies in each level of detail tier during the last step.
+    struct LodStats
+    {
+        size_t bodies[LOD_TIER_COUNT];
+    };
+    
+    /// A bullet whose motion was cut short by continuous collision.
+    struct BulletImpact
+    {
+        std::shared_ptr<Body> body;
+        /// The shape the bullet would have hit.
+        std::shared_ptr<Shape> shape;
+        /// Position of the bullet's sweep circle's edge at the time of impact, and the surface normal there.
+        cpVect point;
+        cpVect normal;
+        /// Fraction of the step at which the sweep hit the shape.
+        cpFloat alpha;
+    };
+    
+    /// The first body whose state differs between two runs of the same simulation.
+    struct DivergenceReport
+    {
+        /// Index of the body in insertion order, or -1 if both runs match.
+        int index;
+        /// The local body at @c index, null if the body only exists in the other run.
+        std::shared_ptr<Body> body;
+        /// Name of the first differing field, or "count" when the runs hold a different number of bodies.
+        const char* field;
+        BodyState expected;
+        BodyState actual;
+    };
+    
     class Space
     {
     public:
@@ -79,6 +161,9 @@ namespace Chipmunk
         /// The Space provided static body for a given cpSpace.
         /// This is merely provided for convenience and you are not required to use it.
         std::shared_ptr<Body> getStaticBody() { return _staticBody; };
+        
+        /// The bodies added to the space, in insertion order.
+        inline const std::vector<std::shared_ptr<Body>>& getBodies() const { return _bodies; };
 
         /// Returns the current (or most recent) time step used with the given space.
         /// Useful from callbacks if your time step is not a compile-time global.
@@ -87,6 +172,24 @@ namespace Chipmunk
         /// returns true from inside a callback when objects cannot be added/removed.
         inline cpBool isLocked() { return cpSpaceIsLocked(_space); };
 
+        /// Deterministic mode hashes the state of every body after each step and delivers separate callbacks
+        /// in a canonical order (sorted by shape creation order) instead of Chipmunk's pointer hashed order.
+        /// Two spaces built with the same insertion order and stepped with the same time steps produce the same hashes.
+        inline bool isDeterministic() const { return _deterministic; };
+        inline void setDeterministic(bool deterministic) { _deterministic = deterministic; };
+
+        /// Hash of the position, velocity and angle of every body, chained with the hash of the previous step.
+        /// Only updated by step() in deterministic mode.
+        inline uint64_t getStateHash() const { return _stateHash; };
+        /// Number of times the space has been stepped.
+        inline uint64_t getStepCount() const { return _stepCount; };
+
+        /// Capture the state of every body in insertion order.
+        std::vector<BodyState> captureState() const;
+        /// Compare the current state against a capture from another run and report the first differing body.
+        /// Values are compared bit for bit, the same way the state hash sees them.
+        DivergenceReport findDivergence(const std::vector<BodyState>& expected) const;
+
         /// Create a collision handler for the specified pair of collision types.
         /// If wildcard handlers are used with either of the collision types, it's the responibility of the custom handler to invoke the wildcard handlers.
         void addCollisionHandler(cpCollisionType a, cpCollisionType b,
@@ -102,6 +205,8 @@ namespace Chipmunk
         void add(std::shared_ptr<Body>);
         /// Add a constraint to the simulation.
         void add(std::shared_ptr<Constraint>);
+        /// Add many collision shapes under a single lock, such as the output of a TerrainBuilder.
+        void add(const std::vector<std::shared_ptr<Shape>>& shapes);
 
         /// Remove a collision shape from the simulation.
         void remove(std::shared_ptr<Shape>);
@@ -109,14 +214,76 @@ namespace Chipmunk
         void remove(std::shared_ptr<Body>);
         /// Remove a constraint from the simulation.
         void remove(std::shared_ptr<Constraint>);
+        /// Remove many collision shapes under a single lock, in time linear in the number of shapes in the space.
+        void remove(const std::vector<std::shared_ptr<Shape>>& shapes);
+        
+        /// Thread safe versions of add, remove and common mutations.
+        /// They can be called from any thread at any time, including while the space is stepping.
+        /// Queued commands are applied in the order they were queued at the start of the next step,
+        /// or by flushCommands(). Commands queued from different threads have no defined order between them.
+        void enqueueAdd(std::shared_ptr<Shape>);
+        void enqueueAdd(std::shared_ptr<Body>);
+        void enqueueAdd(std::shared_ptr<Constraint>);
+        /// Objects that are no longer in the space when the command is applied are ignored.
+        void enqueueRemove(std::shared_ptr<Shape>);
+        void enqueueRemove(std::shared_ptr<Body>);
+        void enqueueRemove(std::shared_ptr<Constraint>);
+        /// Queue an impulse, both the impulse and point are expressed in world coordinates.
+        void enqueueImpulse(std::shared_ptr<Body>, cpVect impulse, cpVect point);
+        /// Queue a change of a shape's collision filter.
+        void enqueueFilter(std::shared_ptr<Shape>, cpShapeFilter filter);
+        /// Queue any other change, @c func is called on the stepping thread with the space unlocked.
+        void enqueue(std::function<void(Space&)> func);
+        /// Apply all queued commands now. Must be called from the thread that steps the space.
+        /// If the space is locked the commands are applied in a post-step callback instead.
+        void flushCommands();
+        
+        /// Reader/writer lock guarding the space.
+        /// Queries take it shared, so any number of threads can query at the same time.
+        /// step(), add(), remove(), reindexing and clearSpace() take it exclusively and wait for queries to finish.
+        /// Hold a ReadWriteLock::ReadGuard on it to keep the space unchanged across a batch of queries.
+        /// Waiting writers hold back new queries, so a steady stream of them from other threads can't starve step().
+        /// A thread holding a ReadGuard must not call step(), add(), remove() or anything else that takes the lock
+        /// exclusively, it would wait for its own read lock forever. Use enqueue() from such threads instead.
+        /// Queries read the spatial indexes directly without locking the cpSpace, so they never write to shared state.
+        /// This requires the default bounding box tree index, cpSpaceUseSpatialHash() modifies the hash while querying.
+        /// @note Inline setters such as setGravity() don't take the lock, only call them between query phases.
+        inline ReadWriteLock& getLock() const { return _lock; };
         
-        /// Query the space at a point and return the nearest shape found. Returns NULL if no shapes were found.
-        std::shared_ptr<Shape> pointQueryNearest(cpVect p, LayerMask, cpGroup) const;
+        /// Query the space at a point and return the nearest shape found within @c maxDistance.
+        /// Returns NULL if no shapes were found.
+        std::shared_ptr<Shape> pointQueryNearest(cpVect p, LayerMask, cpGroup, cpFloat maxDistance = 100.0f) const;
         
+        /// Segment queries optionally take a @c radius, which sweeps a circle along the segment instead of a point.
+        /// A thick query is a cheaper and more accurate stand in for several parallel thin ones.
         /// Perform a directed line segment query (like a raycast) against the space calling @c func for each shape intersected.
-        void segmentQuery(cpVect a, cpVect b, LayerMask, cpGroup, SegmentQueryFunc) const;
+        void segmentQuery(cpVect a, cpVect b, cpFloat radius, LayerMask, cpGroup, SegmentQueryFunc) const;
+        inline void segmentQuery(cpVect a, cpVect b, LayerMask layers, cpGroup group, SegmentQueryFunc func) const
+        { segmentQuery(a, b, 0.0f, layers, group, func); };
         /// Perform a directed line segment query (like a raycast) against the space and return the first shape hit. Returns NULL if no shapes were hit.
-        std::shared_ptr<Shape> segmentQueryFirst(cpVect a, cpVect b, LayerMask, cpGroup, cpSegmentQueryInfo* = nullptr) const;
+        std::shared_ptr<Shape> segmentQueryFirst(cpVect a, cpVect b, cpFloat radius, LayerMask, cpGroup,
+                                                 cpSegmentQueryInfo* = nullptr) const;
+        inline std::shared_ptr<Shape> segmentQueryFirst(cpVect a, cpVect b, LayerMask layers, cpGroup group,
+                                                        cpSegmentQueryInfo* info = nullptr) const
+        { return segmentQueryFirst(a, b, 0.0f, layers, group, info); };
+        /// Return every shape intersected by a segment sorted by distance along it.
+        /// The result is a per-thread buffer that is reused by the next call from the same thread, so no memory is allocated once it has grown.
+        const std::vector<SegmentQueryHit>& segmentQueryAll(cpVect a, cpVect b, cpFloat radius, LayerMask, cpGroup) const;
+        inline const std::vector<SegmentQueryHit>& segmentQueryAll(cpVect a, cpVect b, LayerMask layers, cpGroup group) const
+        { return segmentQueryAll(a, b, 0.0f, layers, group); };
+        /// Run segmentQueryFirst() for @c count segments under a single lock, writing one hit per segment into @c hits.
+        void segmentQueryFirst(const cpVect* starts, const cpVect* ends, size_t count, cpFloat radius,
+                               LayerMask, cpGroup, SegmentQueryHit* hits) const;
+        inline void segmentQueryFirst(const cpVect* starts, const cpVect* ends, size_t count,
+                                      LayerMask layers, cpGroup group, SegmentQueryHit* hits) const
+        { segmentQueryFirst(starts, ends, count, 0.0f, layers, group, hits); };
+        /// Sweep @c shape along a straight line, moving its body's position from @c start to @c end at the body's
+        /// current angle, and return the first shape it would hit. Returns NULL if no shapes were hit.
+        /// @c info receives the time of impact as alpha, the contact point and the hit shape's surface normal.
+        /// Circle, segment and polygon shapes can be cast, the shape doesn't need to be in the space.
+        /// Shapes attached to the cast shape's body, sensors and shapes overlapping it at @c start are ignored.
+        std::shared_ptr<Shape> shapeCast(std::shared_ptr<Shape> shape, cpVect start, cpVect end,
+                                         LayerMask, cpGroup, cpSegmentQueryInfo* = nullptr) const;
 
         /// Update the collision detection info for the static shapes in the space.
         void reindexStatic() { cpSpaceReindexStatic(_space); };
@@ -124,27 +291,122 @@ namespace Chipmunk
         void reindexShape(std::shared_ptr<Shape> shape);
         /// Update the collision detection data for all shapes attached to a body.
         void reindexShapesForBody(std::shared_ptr<Body> body);
+        /// Finish in place geometry changes made with @c update false, the batched form of Shape::geometryChanged().
+        /// Takes the lock once for all shapes and rebuilds the static index in one go when many static shapes changed.
+        /// Can't be called while the space is locked, use enqueue() from callbacks.
+        void updateMorphedShapes(const std::vector<std::shared_ptr<Shape>>& shapes);
         
         /// Step the space forward in time by @c dt.
+        /// Use a ResumableStep to spread a step over several calls instead.
         virtual void step(cpFloat dt);
+        
+        /// Step the space forward by @c dt while trying to keep the step under @c microseconds.
+        /// The cost of recent steps is used to pick a quality level: lower levels use fewer solver iterations
+        /// and substeps and keep contacts cached for longer so warm starting makes up for the weaker solver.
+        /// Full quality uses the space's iterations and collision persistence and getMaxSubsteps() substeps.
+        /// The reduced settings only apply to this call, the space's own settings are restored before it returns.
+        /// Quality only improves by one level per call to avoid oscillating around the budget.
+        /// @note The chosen quality depends on timing, so it breaks deterministic mode across machines.
+        StepQuality stepWithBudget(cpFloat dt, int64_t microseconds);
+        
+        /// Scheduler that runs every parallel part of stepping. Defaults to null, which steps with cpSpaceStep()
+        /// unless the space holds bullets or custom shapes.
+        /// With a scheduler the space is stepped by a StepPipeline that solves independent islands of
+        /// touching bodies as parallel ranges. Each island gets the same result as a single threaded step.
+        /// Body velocity and position update functions are then called from the scheduler's threads.
+        /// Use a SerialScheduler for the pipeline without threads, or wrap an existing job system.
+        inline const std::shared_ptr<TaskScheduler>& getScheduler() const { return _scheduler; };
+        void setScheduler(std::shared_ptr<TaskScheduler> scheduler);
+        
+        /// Number of threads used to step the space, 1 when no scheduler is set.
+        unsigned getThreadCount() const;
+        /// Step on a built in ThreadPool with @c threads threads, or without a scheduler for 1 thread.
+        void setThreadCount(unsigned threads);
+        
+        /// Generate contacts for all overlapping pairs in parallel when stepping with a scheduler.
+        /// Defaults to false. See StepPipeline::setParallelNarrowphase().
+        inline bool getParallelNarrowphase() const { return _parallelNarrowphase; };
+        void setParallelNarrowphase(bool parallel);
+        
+        /// Level of detail stepping picks a tier for every dynamic body from its distance to the nearest observer.
+        /// Bodies beyond the half and quarter rate distances integrate every second or fourth step with the
+        /// combined time step, and bodies beyond the sleep distance are put to sleep, or frozen in place if
+        /// sleeping is disabled, and woken again once an observer comes back within range. Bodies touching each
+        /// other, directly or through other bodies, all step at the highest tier among them.
+        /// Bodies with their own velocity or position update functions always step at full rate.
+        inline bool isLodEnabled() const { return _lodEnabled; };
+        void setLodEnabled(bool enabled);
+        /// Distances at which bodies drop to half rate, quarter rate and sleep. All default to INFINITY.
+        void setLodDistances(cpFloat halfRate, cpFloat quarterRate, cpFloat sleep);
+        /// Points level of detail distances are measured from, usually the players' positions.
+        /// Without observers every body steps at full rate.
+        inline const std::vector<cpVect>& getLodObservers() const { return _lodObservers; };
+        inline void setLodObservers(const std::vector<cpVect>& observers) { _lodObservers = observers; };
+        /// Number of bodies in each tier during the last step, sleeping bodies count as LOD_ASLEEP.
+        inline const LodStats& getLodStats() const { return _lodStats; };
+        
+        /// Continuous collision for small fast bodies that would otherwise pass through thin shapes within one step.
+        /// Before each step every bullet is swept along its velocity as a circle of @c radius against the shapes
+        /// that pass its shape filter, so all shapes of a bullet should share one filter. If the sweep hits one, the bullet's position update is cut short so that it
+        /// ends the step half a radius past the time of impact, where the normal contact resolves the collision.
+        /// A @c radius of 0 uses a circle around the body's position that bounds all of its shapes.
+        /// Sweeps run in parallel on the scheduler, and bullets are stepped by a StepPipeline even without one.
+        /// Rotation is not swept, so long shapes spinning quickly can still tunnel.
+        void setBullet(std::shared_ptr<Body> body, bool bullet, cpFloat radius = 0.0f);
+        bool isBullet(const std::shared_ptr<Body>& body) const;
+        /// Bullets stopped by continuous collision during the last step, in the order they were made bullets.
+        inline const std::vector<BulletImpact>& getBulletImpacts() const { return _bulletImpacts; };
+        
+        /// Number of substeps stepWithBudget() uses at full quality. Defaults to 1.
+        inline int getMaxSubsteps() const { return _maxSubsteps; };
+        inline void setMaxSubsteps(int maxSubsteps) { _maxSubsteps = maxSubsteps; };
 
         // Remove all shapes, bodies and constraints in the space
         virtual void clearSpace();
         
+        /// Create an independent copy of the space with all of its bodies, shapes, constraints,
+        /// collision handlers and settings duplicated. Objects are added in the same order as the original.
+        /// Cached contacts and sleeping state are not copied, so the first step of the copy is not warm started.
+        /// The source space must not be stepped or modified while the copy is being made,
+        /// but several copies of the same space can be made concurrently.
+        std::unique_ptr<Space> clone() const;
+        
         inline cpSpace* getSpace() const { return _space; };
     protected:
         cpSpace* _space;
         std::shared_ptr<Body> _staticBody;
         
     private:
+        friend class ResumableStep;
+        
         Space(const Space&);
         const Space& operator=(const Space&);
         static void segmentQueryFunc(cpShape*, cpVect, cpVect, cpFloat, void*);
         std::shared_ptr<Shape> findShape(cpShape*) const;
+        Shape* lookupShape(cpShape*) const;
+        void indexSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpShapeFilter, cpSpaceSegmentQueryFunc, void* data) const;
+        cpShape* indexSegmentQueryFirst(cpVect a, cpVect b, cpFloat radius, cpShapeFilter, cpSegmentQueryInfo*,
+                                        cpBody* ignore = nullptr) const;
+        cpShape* indexShapeCast(cpShape* shape, cpVect start, cpVect end, cpShapeFilter, cpSegmentQueryInfo*) const;
+        cpShape* indexPointQueryNearest(cpVect p, cpFloat maxDistance, cpShapeFilter, cpPointQueryInfo*) const;
         std::shared_ptr<Body> findBody(cpBody*) const;
         std::shared_ptr<Constraint> findConstraint(cpConstraint*) const;
+        void updateStateHash();
+        void stepSpace(cpFloat dt);
+        void sweepBullets(cpFloat dt, StepPipeline& pipeline);
+        void beginStep();
+        void applyLod();
+        void resetLod();
+        void endStep();
+        StepQuality qualityForLevel(int level) const;
+        
+        struct Command;
+        void pushCommand(Command*);
+        void flushDeferredSeparates();
 
         std::vector<std::shared_ptr<Shape>> _shapes;
+        std::unordered_map<cpShape*, std::shared_ptr<Shape>> _shapeLookup;
+        mutable ReadWriteLock _lock;
         std::vector<std::shared_ptr<Body>> _bodies;
         std::vector<std::shared_ptr<Constraint>> _constraints;
 
@@ -171,6 +433,58 @@ namespace Chipmunk
         
         std::map<std::pair<cpCollisionType, cpCollisionType>, std::unique_ptr<CallbackData>> callbackDatas;
         
+        /// The space's arbiter goes back to its pool, so the callback gets a copy that holds on to the shapes.
+        struct DeferredSeparate
+        {
+            std::shared_ptr<cpArbiter> arbiter;
+            std::shared_ptr<Shape> shapeA;
+            std::shared_ptr<Shape> shapeB;
+            CallbackData* data;
+            cpHashValue a;
+            cpHashValue b;
+        };
+        
+        bool _deterministic;
+        uint64_t _stateHash;
+        uint64_t _stepCount;
+        std::vector<DeferredSeparate> _deferredSeparates;
+        
+        std::atomic<Command*> _commands;
+        
+        int _maxSubsteps;
+        int _qualityLevel;
+        int _fullIterations;
+        cpTimestamp _fullPersistence;
+        double _stepUnitCost;
+        
+        bool _parallelNarrowphase;
+        std::shared_ptr<TaskScheduler> _scheduler;
+        std::unique_ptr<StepPipeline> _pipeline;
+        
+        bool _lodEnabled;
+        cpFloat _lodDistances[LOD_ASLEEP];
+        std::vector<cpVect> _lodObservers;
+        LodStats _lodStats;
+        std::unordered_map<cpBody*, int> _lodTiers;
+        std::unordered_map<cpBody*, cpBody*> _lodGroups;
+        std::unordered_map<cpBody*, uint64_t> _lodPhases;
+        /// Bodies level of detail put to sleep, woken again when an observer comes back within range.
+        std::unordered_set<cpBody*> _lodSlept;
+        
+        struct Bullet
+        {
+            std::shared_ptr<Body> body;
+            cpFloat radius;
+            /// Result of the last sweep, the shape is null if the bullet wasn't clamped.
+            cpSegmentQueryInfo hit;
+            /// Fraction of the step the bullet moves when it was clamped.
+            cpFloat clamp;
+        };
+        std::vector<Bullet> _bullets;
+        std::vector<BulletImpact> _bulletImpacts;
+        /// Number of CustomShapes in the space, which can only be stepped by a StepPipeline.
+        size_t _customShapes;
+        
         static cpBool helperBegin(cpArbiter* arb, cpSpace* s, void* d);
         static cpBool helperPreSolve(cpArbiter* arb, cpSpace* s, void* d);
         static void helperPostSolve(cpArbiter* arb, cpSpace* s, void* d);
@@ -188,6 +502,8 @@ namespace Chipmunk
         static void helperPostConstraintAdd(cpConstraint *constraint, cpSpace *space);
         static void helperBodyAddWrap(cpSpace *space, cpBody *body, void *unused);
         static void helperPostBodyAdd(cpBody *body, cpSpace *space);
+        static void helperCommandsWrap(cpSpace *space, Space *self, void *unused);
+        static void helperPostCommands(Space *self);
     };
 }
 
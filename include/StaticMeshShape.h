@@ -0,0 +1,67 @@
+#ifndef CHIPMUNK_STATICMESHSHAPE_H
+#define CHIPMUNK_STATICMESHSHAPE_H
+
+#include "CustomShape.h"
+#include <cstdint>
+#include <vector>
+
+namespace Chipmunk
+{
+    /// Level geometry made of many edges or triangles sharing one entry in the space's spatial index.
+    /// The primitives are sorted into a bounding volume hierarchy stored as one flat array, which collisions and
+    /// queries descend to reach the few primitives near them.
+    /// Edges meeting exactly two at a vertex are joined like chained segments so shapes slide across them smoothly.
+    class StaticMeshShape : public CustomShape
+    {
+    public:
+        /// @c indices lists @c vertsPerPrimitive vertex indices per primitive, 2 for edges or 3 for triangles.
+        /// Zero length edges and zero area triangles are skipped, triangles may have either winding.
+        StaticMeshShape(std::shared_ptr<Body>,
+                        const std::vector<cpVect>& vertices,
+                        const std::vector<uint32_t>& indices,
+                        int vertsPerPrimitive = 2,
+                        cpFloat radius = 0.0f);
+
+        std::shared_ptr<Shape> clone(std::shared_ptr<Body> body) const override;
+
+        inline size_t getPrimitiveCount() const { return _primitives.size(); };
+        inline int getVertsPerPrimitive() const { return _vertsPerPrimitive; };
+        inline cpFloat getRadius() const { return _radius; };
+
+    protected:
+        cpBB localBounds() const override;
+        void localParts(cpBB bb, std::vector<Part>& parts) const override;
+        bool localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const override;
+        void localPointQuery(cpVect p, cpPointQueryInfo* info) const override;
+
+    private:
+        struct Primitive
+        {
+            cpVect verts[3];
+            cpVect prev;
+            cpVect next;
+            cpBB bb;
+            bool hasNeighbors;
+        };
+
+        /// A leaf holds @c count primitives starting at @c offset. An inner node has a count of 0,
+        /// its first child follows it and its second child is at @c offset.
+        struct Node
+        {
+            cpBB bb;
+            uint32_t offset;
+            uint32_t count;
+        };
+
+        void build(std::vector<Primitive>& primitives, size_t begin, size_t end);
+        void primitivePart(size_t index, Part& part) const;
+
+        int _vertsPerPrimitive;
+        cpFloat _radius;
+        /// Primitives in the order of the leaves that hold them.
+        std::vector<Primitive> _primitives;
+        std::vector<Node> _nodes;
+    };
+}
+
+#endif /* CHIPMUNK_STATICMESHSHAPE_H */
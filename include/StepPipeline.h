@@ -0,0 +1,135 @@
+#ifndef CHIPMUNK_STEPPIPELINE_H
+#define CHIPMUNK_STEPPIPELINE_H
+
+#include <chipmunk.h>
+#include <chipmunk_structs.h>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace Chipmunk
+{
+    class TaskScheduler;
+
+    /// Steps a cpSpace the same way cpSpaceStep() does, split into separate phases so that
+    /// the phases can run on several threads.
+    /// Contacts and constraints are grouped into islands of dynamic bodies that touch each other.
+    /// Islands share no dynamic bodies, so they are solved concurrently, each in the same order
+    /// cpSpaceStep() would solve it, and give exactly the same result as a serial step.
+    /// Static and kinematic bodies shared by several islands are replaced by a copy per island while solving.
+    /// Velocity and position update functions run on worker threads and must only touch their own body.
+    /// Pairs involving a CustomShape are collided with CustomShape::collide(), cpSpaceStep() can't step those.
+    class StepPipeline
+    {
+    public:
+        explicit StepPipeline(cpSpace* space);
+
+        /// Scheduler used to run the phases, null runs everything on the calling thread.
+        inline TaskScheduler* getScheduler() const { return _scheduler; };
+        inline void setScheduler(TaskScheduler* scheduler) { _scheduler = scheduler; };
+
+        /// Collect broadphase pairs first and generate their contacts in parallel. Defaults to false.
+        /// Arbiters are still updated and begin and pre solve callbacks still run serially in broadphase order.
+        /// Polygon contacts don't feed their warm start hint back to the broadphase, so they can differ from
+        /// a serial step in the last bits, but repeated runs stay deterministic.
+        inline bool getParallelNarrowphase() const { return _parallelNarrowphase; };
+        inline void setParallelNarrowphase(bool parallel) { _parallelNarrowphase = parallel; };
+
+        /// Run every phase in order, equivalent to cpSpaceStep().
+        void step(cpFloat dt);
+
+        /// Start a step, returns false if there is nothing to do because @c dt is 0.
+        /// The remaining phases must then be called in the order they are declared in.
+        bool begin(cpFloat dt);
+        /// Move bodies by their velocity.
+        void integratePositions();
+        /// Update shape bounding boxes and find overlapping pairs.
+        /// Without the parallel narrowphase this also finds contacts like cpSpaceStep() does.
+        void broadphase();
+        /// Generate contacts for the overlapping pairs and update arbiters, calling begin and pre solve callbacks.
+        void narrowphase();
+        /// Rebuild the contact graph and put idle bodies to sleep.
+        void processComponents();
+        /// Drop stale contacts, group the rest into islands and prepare them for solving.
+        void preStep();
+        /// Apply gravity, damping and forces to velocities.
+        void integrateVelocities();
+        /// Warm start the solver with last step's impulses.
+        void applyCachedImpulses();
+        /// Run @c count iterations of the impulse solver.
+        void solve(int count);
+        /// Run post solve callbacks and post-step callbacks, ending the step.
+        void finish();
+
+        /// Limit the next position update of @c body to the fraction @c alpha of the time step.
+        /// Used by continuous collision to stop a fast body at its time of impact. Applies to one step only,
+        /// and is dropped if begin() doesn't start one.
+        void clampMotion(cpBody* body, cpFloat alpha);
+
+        /// Number of islands found by the last call to preStep().
+        inline size_t getIslandCount() const { return _islands.size(); };
+
+    private:
+        StepPipeline(const StepPipeline&);
+        const StepPipeline& operator=(const StepPipeline&);
+
+        struct NarrowphasePair
+        {
+            cpShape* a;
+            cpShape* b;
+            cpCollisionID id;
+            struct cpCollisionInfo info;
+            struct cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
+        };
+
+        static cpCollisionID collectPair(cpShape* a, cpShape* b, cpCollisionID id, StepPipeline* self);
+        static cpCollisionID collideShapes(cpShape* a, cpShape* b, cpCollisionID id, StepPipeline* self);
+        static void collectShape(cpShape* shape, std::vector<cpShape*>* shapes);
+        static void* arbiterSetTrans(cpShape** shapes, cpSpace* space);
+        static bool queryReject(const cpShape* a, const cpShape* b);
+        void applyPair(NarrowphasePair& pair);
+
+        struct Island
+        {
+            int arbiterStart;
+            int arbiterCount;
+            int constraintStart;
+            int constraintCount;
+        };
+
+        void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& func);
+        size_t islandGrain() const;
+        void buildIslands();
+        int bodyIndex(cpBody*);
+        int findRoot(int);
+        int islandFor(cpBody*, cpBody*);
+
+        cpSpace* _space;
+        TaskScheduler* _scheduler;
+        cpFloat _dt;
+        cpFloat _prevDt;
+        bool _parallelNarrowphase;
+
+        struct MotionClamp
+        {
+            cpBody* body;
+            cpFloat alpha;
+            cpBodyPositionFunc func;
+        };
+        std::vector<MotionClamp> _clamps;
+
+        std::vector<cpShape*> _shapes;
+        std::vector<NarrowphasePair> _pairs;
+
+        std::unordered_map<cpBody*, int> _bodyIndices;
+        std::vector<int> _parents;
+        std::vector<int> _rootIslands;
+        std::vector<int> _arbiterIslands;
+        std::vector<int> _constraintIslands;
+        std::vector<Island> _islands;
+        std::vector<cpArbiter*> _islandArbiters;
+        std::vector<cpConstraint*> _islandConstraints;
+    };
+}
+
+#endif /* CHIPMUNK_STEPPIPELINE_H */
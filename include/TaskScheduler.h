@@ -0,0 +1,29 @@
+#ifndef CHIPMUNK_TASKSCHEDULER_H
+#define CHIPMUNK_TASKSCHEDULER_H
+
+#include <cstddef>
+#include <functional>
+
+namespace Chipmunk
+{
+    /// Runs the parallel parts of the library, implement it to run them on an existing job system.
+    /// The library only ever has one parallelFor() outstanding per scheduler and always waits for it
+    /// before starting the next one, but func may itself call parallelFor() and wait() from inside a range.
+    class TaskScheduler
+    {
+    public:
+        virtual ~TaskScheduler() { };
+
+        /// Number of threads work is spread over, used to size ranges.
+        virtual unsigned getThreadCount() const = 0;
+
+        /// Start calling @c func with consecutive sub ranges of [0, count) of at most @c grain items.
+        /// Ranges may run in any order and on any thread, the call may return before they are done.
+        virtual void parallelFor(size_t count, size_t grain, std::function<void(size_t begin, size_t end)> func) = 0;
+
+        /// Return once every range started by this thread's last parallelFor() has finished.
+        virtual void wait() = 0;
+    };
+}
+
+#endif /* CHIPMUNK_TASKSCHEDULER_H */
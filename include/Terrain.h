@@ -0,0 +1,73 @@
+#ifndef CHIPMUNK_TERRAIN_H
+#define CHIPMUNK_TERRAIN_H
+
+#include "TerrainBuilder.h"
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace Chipmunk
+{
+    class Body;
+    class Shape;
+    class Space;
+
+    /// Destructible terrain that keeps the segment shapes traced by a TerrainBuilder per tile.
+    /// After the density field is edited, invalidate() the changed area and update() traces only the tiles it
+    /// touched again. Segments that didn't change keep their shapes, and the shapes that were removed or added are
+    /// swapped in the space by one queued command, applied before the next step or right after the current one.
+    /// Segments continuing into a neighbouring tile are joined to it like the segments of a single polyline.
+    class Terrain
+    {
+    public:
+        /// The shapes are attached to the static @c body and added to @c space, which must outlive the terrain.
+        /// Every tile starts out invalid, so the first update() builds the whole terrain.
+        Terrain(Space& space, std::shared_ptr<Body> body, std::shared_ptr<const TerrainBuilder> builder);
+
+        /// Mark the tiles around @c area, in the builder's coordinates, to be traced again on the next update().
+        void invalidate(cpBB area);
+        /// Mark every tile to be traced again on the next update().
+        void invalidateAll();
+        /// Trace the invalid tiles, on the builder's scheduler if it has one, and queue the swap of their shapes.
+        /// Can be called from any thread that doesn't edit the density field at the same time.
+        void update();
+
+        inline const std::shared_ptr<const TerrainBuilder>& getBuilder() const { return _builder; };
+        inline size_t getTileCount() const { return _tiles.size(); };
+        /// Shapes of a tile after the last update(), they may still be waiting to be swapped into the space.
+        std::vector<std::shared_ptr<Shape>> getShapes(size_t tile) const;
+
+    private:
+        struct Segment
+        {
+            TerrainBuilder::Edge edge;
+            std::shared_ptr<Shape> shape;
+        };
+
+        struct Tile
+        {
+            cpBB bounds;
+            bool invalid;
+            std::vector<Segment> segments;
+        };
+
+        /// Tile and segment index of a segment with an end on its tile's edge.
+        typedef std::pair<size_t, size_t> SegmentRef;
+        typedef std::pair<cpFloat, cpFloat> PointKey;
+
+        bool onEdge(const Tile& tile, cpVect p) const;
+        void unlink(size_t tile, std::vector<SegmentRef>& touched);
+        void link(size_t tile, std::vector<SegmentRef>& touched);
+
+        Space& _space;
+        std::shared_ptr<Body> _body;
+        std::shared_ptr<const TerrainBuilder> _builder;
+        std::vector<Tile> _tiles;
+        /// Segments starting and ending on tile edges, where the polylines of neighbouring tiles meet.
+        std::map<PointKey, SegmentRef> _starts;
+        std::map<PointKey, SegmentRef> _ends;
+    };
+}
+
+#endif /* CHIPMUNK_TERRAIN_H */
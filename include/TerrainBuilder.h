@@ -0,0 +1,110 @@
+#ifndef CHIPMUNK_TERRAINBUILDER_H
+#define CHIPMUNK_TERRAINBUILDER_H
+
+#include <chipmunk.h>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Chipmunk
+{
+    class Body;
+    class Shape;
+    class TaskScheduler;
+
+    /// Builds static terrain out of segment shapes from a density field such as a bitmap.
+    /// The field is sampled on a regular grid over @c bounds and the contour at the threshold is traced with marching
+    /// squares. The grid is split into tiles traced in parallel, and the pieces of contour are joined across the tile
+    /// seams into polylines, which are then simplified and turned into segments with their neighbours set.
+    /// Solid samples on the edge of the bounds leave the contour open there, so keep the edges empty for closed outlines.
+    /// Use a Terrain to keep the shapes per tile and only rebuild the tiles that changed.
+    class TerrainBuilder
+    {
+    public:
+        /// Density at a sample point. With a scheduler it's called from several threads at once.
+        typedef std::function<cpFloat(cpVect)> SampleFunc;
+
+        /// A segment of a polyline with the vertexes on either side of it, @c a or @c b where the polyline ends.
+        struct Edge
+        {
+            cpVect a;
+            cpVect b;
+            cpVect prev;
+            cpVect next;
+        };
+
+        /// Sample @c sample at @c xSamples by @c ySamples points spread evenly over @c bounds, both at least 2.
+        TerrainBuilder(cpBB bounds, unsigned long xSamples, unsigned long ySamples, SampleFunc sample);
+        /// Sample an 8 bit image one pixel per sample with densities from 0 to 1, row 0 being the top of @c bounds.
+        /// @c stride is the number of bytes between rows, 0 for @c width. The pixels are read on every build and
+        /// must outlive the builder, edit them between builds for destructible terrain.
+        TerrainBuilder(cpBB bounds, const uint8_t* pixels, unsigned long width, unsigned long height, size_t stride = 0);
+
+        inline cpBB getBounds() const { return _bounds; };
+        inline unsigned long getXSamples() const { return _xSamples; };
+        inline unsigned long getYSamples() const { return _ySamples; };
+
+        /// Density the contour is traced at, 0.5 by default.
+        inline cpFloat getThreshold() const { return _threshold; };
+        inline void setThreshold(cpFloat threshold) { _threshold = threshold; };
+        /// Trace with cpMarchHard(), which follows the grid for pixel art, instead of the interpolating cpMarchSoft().
+        inline bool getHard() const { return _hard; };
+        inline void setHard(bool hard) { _hard = hard; };
+        /// Tolerance passed to cpPolylineSimplifyCurves(), 0 by default which keeps every traced vertex.
+        inline cpFloat getSimplifyTolerance() const { return _simplifyTolerance; };
+        inline void setSimplifyTolerance(cpFloat tolerance) { _simplifyTolerance = tolerance; };
+        /// Radius of the segment shapes that are built, 0 by default.
+        inline cpFloat getRadius() const { return _radius; };
+        inline void setRadius(cpFloat radius) { _radius = radius; };
+        /// Number of grid cells along each side of a tile, 32 by default.
+        inline unsigned long getTileCells() const { return _tileCells; };
+        void setTileCells(unsigned long cells);
+        /// Scheduler the tiles are traced on, null by default to trace them on the calling thread.
+        inline const std::shared_ptr<TaskScheduler>& getScheduler() const { return _scheduler; };
+        inline void setScheduler(std::shared_ptr<TaskScheduler> scheduler) { _scheduler = scheduler; };
+
+        /// Trace and simplify the contour. Closed polylines repeat their first vertex at the end.
+        std::vector<std::vector<cpVect>> trace() const;
+        /// Trace the contour and create a segment shape for each polyline edge, attached to a static @c body.
+        /// The shapes are ready for Space::add() and share the surface properties of a default shape.
+        std::vector<std::shared_ptr<Shape>> build(std::shared_ptr<Body> body) const;
+
+        /// Number of tiles the grid is split into, row by row from the bottom left.
+        size_t getTileCount() const;
+        /// Area covered by a tile, neighbouring tiles share their edges.
+        cpBB getTileBounds(size_t tile) const;
+        /// Trace and simplify the contour inside one tile on the calling thread.
+        /// Polylines end exactly on the tile's edges where they continue into a neighbouring tile.
+        std::vector<std::vector<cpVect>> traceTile(size_t tile) const;
+        /// Split polylines into their edges.
+        static std::vector<Edge> edges(const std::vector<std::vector<cpVect>>& lines);
+
+    private:
+        struct TileContext;
+
+        cpVect samplePoint(unsigned long i, unsigned long j) const;
+        cpFloat sampleAt(unsigned long i, unsigned long j) const;
+        void tileRange(size_t tile, unsigned long& i0, unsigned long& j0, unsigned long& i1, unsigned long& j1) const;
+        void marchTile(size_t tile, std::vector<std::vector<cpVect>>& lines) const;
+        void simplify(std::vector<cpVect>& line) const;
+
+        static cpFloat marchSample(cpVect point, void* data);
+        static void marchSegment(cpVect a, cpVect b, void* data);
+
+        cpBB _bounds;
+        unsigned long _xSamples;
+        unsigned long _ySamples;
+        SampleFunc _sample;
+        const uint8_t* _pixels;
+        size_t _stride;
+        cpFloat _threshold;
+        bool _hard;
+        cpFloat _simplifyTolerance;
+        cpFloat _radius;
+        unsigned long _tileCells;
+        std::shared_ptr<TaskScheduler> _scheduler;
+    };
+}
+
+#endif /* CHIPMUNK_TERRAINBUILDER_H */
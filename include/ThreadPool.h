@@ -0,0 +1,54 @@
+#ifndef CHIPMUNK_THREADPOOL_H
+#define CHIPMUNK_THREADPOOL_H
+
+#include "TaskScheduler.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Chipmunk
+{
+    /// The built in scheduler, a fixed set of worker threads that split ranges of work between them.
+    /// The thread that calls wait() takes part in the work, so a pool with no workers runs everything serially.
+    class ThreadPool : public TaskScheduler
+    {
+    public:
+        /// Create a pool that runs work on @c threads threads in total, including the waiting thread.
+        explicit ThreadPool(unsigned threads = std::thread::hardware_concurrency());
+        virtual ~ThreadPool();
+
+        /// Number of threads that take part in a parallelFor(), including the waiting thread.
+        virtual unsigned getThreadCount() const;
+
+        /// Only one parallelFor() runs on the workers at a time.
+        /// Calls made while one is running, including from inside its ranges, run serially before returning.
+        virtual void parallelFor(size_t count, size_t grain, std::function<void(size_t begin, size_t end)> func);
+        virtual void wait();
+
+    private:
+        ThreadPool(const ThreadPool&);
+        const ThreadPool& operator=(const ThreadPool&);
+
+        void workerLoop();
+        void runChunks();
+
+        std::vector<std::thread> _workers;
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::condition_variable _done;
+        std::atomic<bool> _active;
+        std::atomic<std::thread::id> _owner;
+
+        std::function<void(size_t, size_t)> _func;
+        size_t _count;
+        size_t _grain;
+        std::atomic<size_t> _next;
+        unsigned _generation;
+        unsigned _busy;
+        bool _quit;
+    };
+}
+
+#endif /* CHIPMUNK_THREADPOOL_H */
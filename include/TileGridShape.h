@@ -0,0 +1,59 @@
+#ifndef CHIPMUNK_TILEGRIDSHAPE_H
+#define CHIPMUNK_TILEGRIDSHAPE_H
+
+#include "CustomShape.h"
+#include <cstdint>
+#include <vector>
+
+namespace Chipmunk
+{
+    /// A tilemap of square solid tiles stored as one material id per tile, where 0 is an empty tile.
+    /// Column x and row y cover origin + (x, y)*tileSize to origin + (x + 1, y + 1)*tileSize in body coordinates.
+    /// Shapes only collide with the tiles under their bounding box, and runs of solid tiles in a row are merged
+    /// into one box so shapes sliding along a floor don't catch on the seams between tiles.
+    class TileGridShape : public CustomShape
+    {
+    public:
+        TileGridShape(std::shared_ptr<Body>, int width, int height, cpFloat tileSize, cpVect origin = cpv(0, 0));
+
+        std::shared_ptr<Shape> clone(std::shared_ptr<Body> body) const override;
+
+        inline int getWidth() const { return _width; };
+        inline int getHeight() const { return _height; };
+        inline cpFloat getTileSize() const { return _tileSize; };
+        inline cpVect getOrigin() const { return _origin; };
+
+        /// Material of the tile at column @c x and row @c y, tiles outside the grid are empty.
+        uint8_t getTile(int x, int y) const;
+        /// Set the material of a tile, 0 clears it.
+        /// The grid's bounds never change, so nothing is reindexed, and bodies touching the grid within half a tile
+        /// of the changed one are woken up.
+        /// Must not be called while the space is stepping, use Space::enqueue() from other threads.
+        void setTile(int x, int y, uint8_t material);
+        /// Material of the tile containing @c point in world coordinates, useful in collision callbacks.
+        uint8_t getMaterialAt(cpVect point) const;
+
+    protected:
+        cpBB localBounds() const override;
+        void localParts(cpBB bb, std::vector<Part>& parts) const override;
+        /// Thin queries walk the tiles along the segment, thick ones test the tiles under the swept box.
+        /// Queries starting inside a solid tile never get here, cpShapeSegmentQuery() reports them at alpha 0 from the
+        /// point query it runs first, like it does for Chipmunk's own shapes.
+        bool localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const override;
+        void localPointQuery(cpVect p, cpPointQueryInfo* info) const override;
+
+    private:
+        int columnAt(cpFloat x) const;
+        int rowAt(cpFloat y) const;
+        bool isSolid(int x, int y) const;
+        void boxPart(int x0, int x1, int y, Part& part) const;
+
+        int _width;
+        int _height;
+        cpFloat _tileSize;
+        cpVect _origin;
+        std::vector<uint8_t> _tiles;
+    };
+}
+
+#endif /* CHIPMUNK_TILEGRIDSHAPE_H */
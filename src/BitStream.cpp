@@ -0,0 +1,91 @@
+#include "BitStream.h"
+
+namespace Chipmunk
+{
+    BitWriter::BitWriter(std::vector<uint8_t>& buffer) :
+    _buffer(buffer),
+    _bits(buffer.size()*8)
+    { }
+
+    void BitWriter::write(uint32_t value, int bits)
+    {
+        for (int i = 0; i < bits; i++)
+        {
+            if ((_bits & 7) == 0)
+            {
+                _buffer.push_back(0);
+            }
+            if (value & (1u << i))
+            {
+                _buffer.back() |= static_cast<uint8_t>(1u << (_bits & 7));
+            }
+            _bits++;
+        }
+    }
+
+    void BitWriter::writeVarint(uint32_t value, int groupBits)
+    {
+        uint32_t mask = (1u << groupBits) - 1;
+        while (value > mask)
+        {
+            write(value & mask, groupBits);
+            write(1, 1);
+            value >>= groupBits;
+        }
+        write(value, groupBits);
+        write(0, 1);
+    }
+
+    void BitWriter::writeSignedVarint(int32_t value, int groupBits)
+    {
+        // Zigzag encoding maps 0, -1, 1, -2, 2 ... to 0, 1, 2, 3, 4 ...
+        uint32_t zigzag = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+        writeVarint(zigzag, groupBits);
+    }
+
+    BitReader::BitReader(const uint8_t* data, size_t size) :
+    _data(data),
+    _size(size),
+    _bits(0),
+    _overflow(false)
+    { }
+
+    uint32_t BitReader::read(int bits)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < bits; i++)
+        {
+            if (_bits >= _size*8)
+            {
+                _overflow = true;
+                return 0;
+            }
+            if (_data[_bits >> 3] & (1u << (_bits & 7)))
+            {
+                value |= 1u << i;
+            }
+            _bits++;
+        }
+        return value;
+    }
+
+    uint32_t BitReader::readVarint(int groupBits)
+    {
+        uint32_t value = 0;
+        for (int shift = 0; shift < 32; shift += groupBits)
+        {
+            value |= read(groupBits) << shift;
+            if (!read(1) || _overflow)
+            {
+                break;
+            }
+        }
+        return value;
+    }
+
+    int32_t BitReader::readSignedVarint(int groupBits)
+    {
+        uint32_t zigzag = readVarint(groupBits);
+        return static_cast<int32_t>((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+    }
+}
@@ -1,5 +1,8 @@
 #include "Body.h"
 #include "Shape.h"
+extern "C" {
+#include <chipmunk_private.h>
+}
 
 namespace Chipmunk
 {
@@ -22,6 +25,35 @@ namespace Chipmunk
         return _body;
     }
     
+    std::shared_ptr<Body> Body::clone() const
+    {
+        cpBody* body;
+        switch (cpBodyGetType(_body))
+        {
+            case CP_BODY_TYPE_STATIC:
+                body = cpBodyNewStatic();
+                break;
+            case CP_BODY_TYPE_KINEMATIC:
+                body = cpBodyNewKinematic();
+                break;
+            default:
+                body = cpBodyNew(cpBodyGetMass(_body), cpBodyGetMoment(_body));
+                break;
+        }
+        // The center of gravity must be set before the position so the transform is rebuilt correctly.
+        cpBodySetCenterOfGravity(body, cpBodyGetCenterOfGravity(_body));
+        cpBodySetPosition(body, cpBodyGetPosition(_body));
+        cpBodySetAngle(body, cpBodyGetAngle(_body));
+        cpBodySetVelocity(body, cpBodyGetVelocity(_body));
+        cpBodySetAngularVelocity(body, cpBodyGetAngularVelocity(_body));
+        cpBodySetForce(body, cpBodyGetForce(_body));
+        cpBodySetTorque(body, cpBodyGetTorque(_body));
+        cpBodySetUserData(body, cpBodyGetUserData(_body));
+        cpBodySetVelocityUpdateFunc(body, _body->velocity_func);
+        cpBodySetPositionUpdateFunc(body, _body->position_func);
+        return std::make_shared<Body>(body);
+    }
+    
     Body::~Body()
     {
         if (_body != NULL)
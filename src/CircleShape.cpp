@@ -1,5 +1,6 @@
 #include "CircleShape.h"
 #include "Body.h"
+#include <chipmunk_unsafe.h>
 
 namespace Chipmunk
 {
@@ -9,4 +10,31 @@ namespace Chipmunk
     Shape(cpCircleShapeNew(body ? (*body) :
                                     (cpBody*)0, radius, offset), body)
     { }
+    
+    std::shared_ptr<Shape> CircleShape::clone(std::shared_ptr<Body> body) const
+    {
+        auto shape = std::make_shared<CircleShape>(body,
+                                                   cpCircleShapeGetRadius(_shape),
+                                                   cpCircleShapeGetOffset(_shape));
+        copyProperties(*shape);
+        return shape;
+    }
+    
+    void CircleShape::setOffset(cpVect offset, bool update)
+    {
+        cpCircleShapeSetOffset(_shape, offset);
+        if (update)
+        {
+            geometryChanged();
+        }
+    }
+    
+    void CircleShape::setRadius(cpFloat radius, bool update)
+    {
+        cpCircleShapeSetRadius(_shape, radius);
+        if (update)
+        {
+            geometryChanged();
+        }
+    }
 }
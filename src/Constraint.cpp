@@ -20,4 +20,22 @@ namespace Chipmunk
     {
         return _constraint;
     }
+    
+    std::shared_ptr<Constraint> Constraint::clone(std::shared_ptr<Body>, std::shared_ptr<Body>) const
+    {
+        cpAssertHard(false, "clone not supported for this type.");
+        return nullptr;
+    }
+    
+    void Constraint::copyProperties(Constraint& constraint) const
+    {
+        cpConstraint* c = constraint._constraint;
+        cpConstraintSetMaxForce(c, cpConstraintGetMaxForce(_constraint));
+        cpConstraintSetErrorBias(c, cpConstraintGetErrorBias(_constraint));
+        cpConstraintSetMaxBias(c, cpConstraintGetMaxBias(_constraint));
+        cpConstraintSetCollideBodies(c, cpConstraintGetCollideBodies(_constraint));
+        cpConstraintSetPreSolveFunc(c, cpConstraintGetPreSolveFunc(_constraint));
+        cpConstraintSetPostSolveFunc(c, cpConstraintGetPostSolveFunc(_constraint));
+        cpConstraintSetUserData(c, cpConstraintGetUserData(_constraint));
+    }
 }
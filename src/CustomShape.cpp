@@ -0,0 +1,298 @@
+#include "CustomShape.h"
+#include "Body.h"
+extern "C" {
+#include <chipmunk_private.h>
+}
+#include <chipmunk_unsafe.h>
+#include <algorithm>
+
+namespace Chipmunk
+{
+    struct CustomShape::Data
+    {
+        cpShape shape;
+        const CustomShape* owner;
+        cpTransform transform;
+        cpTransform inverse;
+    };
+
+    const cpShapeClass CustomShape::customClass = {
+        CP_NUM_SHAPES,
+        CustomShape::shapeCacheData,
+        CustomShape::shapeDestroy,
+        CustomShape::shapePointQuery,
+        CustomShape::shapeSegmentQuery,
+    };
+
+    namespace
+    {
+        /// Scratch shapes that parts are loaded into to reuse Chipmunk's collision and query routines.
+        struct PartShapes
+        {
+            /// Segment collisions read the rotation of the segment's body, parts are in world coordinates.
+            cpBody body;
+            cpSegmentShape segment;
+            cpPolyShape poly;
+
+            PartShapes()
+            {
+                cpBodyInit(&body, 0.0f, 0.0f);
+                cpSegmentShapeInit(&segment, &body, cpvzero, cpv(1.0f, 0.0f), 0.0f);
+                cpVect square[] = { cpv(0.0f, 0.0f), cpv(1.0f, 0.0f), cpv(1.0f, 1.0f), cpv(0.0f, 1.0f) };
+                cpPolyShapeInitRaw(&poly, &body, 4, square, 0.0f);
+            }
+        };
+
+        cpShape* partShape(const CustomShape::Part& part, cpHashValue hashid)
+        {
+            static thread_local PartShapes shapes;
+            cpShape* shape;
+            if (part.count == 2)
+            {
+                cpSegmentShape* segment = &shapes.segment;
+                segment->a = part.verts[0];
+                segment->b = part.verts[1];
+                segment->n = cpvperp(cpvnormalize(cpvsub(part.verts[1], part.verts[0])));
+                segment->r = part.radius;
+                segment->a_tangent = part.hasNeighbors ? cpvsub(part.prev, part.verts[0]) : cpvzero;
+                segment->b_tangent = part.hasNeighbors ? cpvsub(part.next, part.verts[1]) : cpvzero;
+                shape = &segment->shape;
+            }
+            else
+            {
+                shape = &shapes.poly.shape;
+                cpPolyShapeSetVertsRaw(shape, part.count, const_cast<cpVect*>(part.verts));
+                shapes.poly.r = part.radius;
+            }
+            shape->hashid = hashid;
+            cpShapeUpdate(shape, cpTransformIdentity);
+            return shape;
+        }
+
+        struct PartContact
+        {
+            struct cpContact contact;
+            cpVect normal;
+            cpFloat depth;
+        };
+    }
+
+    CustomShape::CustomShape(std::shared_ptr<Body> body) :
+    Shape(newShape(body), body)
+    {
+        reinterpret_cast<Data*>(_shape)->owner = this;
+    }
+
+    cpShape* CustomShape::newShape(std::shared_ptr<Body> body)
+    {
+        Data* data = (Data*)cpcalloc(1, sizeof(Data));
+        struct cpShapeMassInfo massInfo = { 0.0f, 0.0f, cpvzero, 0.0f };
+        cpShapeInit(&data->shape, &customClass, body ? (*body) : (cpBody*)NULL, massInfo);
+        data->owner = nullptr;
+        data->transform = cpTransformIdentity;
+        data->inverse = cpTransformIdentity;
+        return &data->shape;
+    }
+
+    bool CustomShape::isCustom(const cpShape* shape)
+    {
+        return shape->klass == &customClass;
+    }
+
+    const CustomShape* CustomShape::fromShape(const cpShape* shape)
+    {
+        return reinterpret_cast<const Data*>(shape)->owner;
+    }
+
+    cpBB CustomShape::shapeCacheData(cpShape* shape, cpTransform transform)
+    {
+        Data* data = reinterpret_cast<Data*>(shape);
+        data->transform = transform;
+        data->inverse = cpTransformRigidInverse(transform);
+        return cpTransformbBB(transform, data->owner->localBounds());
+    }
+
+    void CustomShape::shapeDestroy(cpShape*)
+    {
+    }
+
+    void CustomShape::shapePointQuery(const cpShape* shape, cpVect p, cpPointQueryInfo* info)
+    {
+        const Data* data = reinterpret_cast<const Data*>(shape);
+        cpPointQueryInfo local = { nullptr, cpvzero, INFINITY, cpvzero };
+        data->owner->localPointQuery(cpTransformPoint(data->inverse, p), &local);
+        info->shape = shape;
+        info->point = cpTransformPoint(data->transform, local.point);
+        info->distance = local.distance;
+        info->gradient = cpTransformVect(data->transform, local.gradient);
+    }
+
+    void CustomShape::shapeSegmentQuery(const cpShape* shape, cpVect a, cpVect b, cpFloat radius,
+                                        cpSegmentQueryInfo* info)
+    {
+        const Data* data = reinterpret_cast<const Data*>(shape);
+        cpVect la = cpTransformPoint(data->inverse, a);
+        cpVect lb = cpTransformPoint(data->inverse, b);
+        cpSegmentQueryInfo local = { nullptr, lb, cpvzero, 1.0f };
+        if (data->owner->localSegmentQuery(la, lb, radius, &local))
+        {
+            info->shape = shape;
+            info->point = cpTransformPoint(data->transform, local.point);
+            info->normal = cpTransformVect(data->transform, local.normal);
+            info->alpha = local.alpha;
+        }
+    }
+
+    void CustomShape::queryParts(cpBB bb, std::vector<Part>& parts) const
+    {
+        const Data* data = reinterpret_cast<const Data*>(_shape);
+        size_t first = parts.size();
+        localParts(cpTransformbBB(data->inverse, bb), parts);
+        for (size_t i = first; i < parts.size(); i++)
+        {
+            Part& part = parts[i];
+            for (int v = 0; v < part.count; v++)
+            {
+                part.verts[v] = cpTransformPoint(data->transform, part.verts[v]);
+            }
+            part.prev = cpTransformPoint(data->transform, part.prev);
+            part.next = cpTransformPoint(data->transform, part.next);
+        }
+    }
+
+    bool CustomShape::localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const
+    {
+        static thread_local std::vector<Part> parts;
+        parts.clear();
+        localParts(cpBBNew(cpfmin(a.x, b.x) - radius, cpfmin(a.y, b.y) - radius,
+                           cpfmax(a.x, b.x) + radius, cpfmax(a.y, b.y) + radius), parts);
+
+        bool found = false;
+        for (auto& part : parts)
+        {
+            cpSegmentQueryInfo hit;
+            if (partSegmentQuery(part, a, b, radius, &hit) && hit.alpha < info->alpha)
+            {
+                *info = hit;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    void CustomShape::localPointQuery(cpVect p, cpPointQueryInfo* info) const
+    {
+        static thread_local std::vector<Part> parts;
+        // Start with a box around p reaching the shape's bounds and double it until it holds a part closer than the
+        // box's half size, any closer part would overlap the box too.
+        cpBB bounds = localBounds();
+        cpFloat dx = cpfmax(cpfmax(bounds.l - p.x, p.x - bounds.r), 0.0f);
+        cpFloat dy = cpfmax(cpfmax(bounds.b - p.y, p.y - bounds.t), 0.0f);
+        cpFloat reach = cpfmax(cpfmax(dx, dy), cpfmax(bounds.r - bounds.l, bounds.t - bounds.b)/64.0f);
+        while (true)
+        {
+            cpBB box = cpBBNewForExtents(p, reach, reach);
+            parts.clear();
+            localParts(box, parts);
+            for (auto& part : parts)
+            {
+                cpPointQueryInfo nearest;
+                partPointQuery(part, p, &nearest);
+                if (nearest.distance < info->distance)
+                {
+                    *info = nearest;
+                }
+            }
+            if (info->distance <= reach || cpBBContainsBB(box, bounds))
+            {
+                return;
+            }
+            reach *= 2.0f;
+        }
+    }
+
+    bool CustomShape::partSegmentQuery(const Part& part, cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info)
+    {
+        return cpShapeSegmentQuery(partShape(part, 0), a, b, radius, info) == cpTrue;
+    }
+
+    void CustomShape::partPointQuery(const Part& part, cpVect p, cpPointQueryInfo* info)
+    {
+        cpShapePointQuery(partShape(part, 0), p, info);
+    }
+
+    struct cpCollisionInfo CustomShape::collide(const cpShape* a, const cpShape* b, cpCollisionID id,
+                                                struct cpContact* contacts)
+    {
+        // Custom shapes have the highest shape type, so like cpCollide() they go second.
+        struct cpCollisionInfo info = { a, b, id, cpvzero, 0, contacts };
+        if (isCustom(a))
+        {
+            info.a = b;
+            info.b = a;
+        }
+        if (isCustom(info.a))
+        {
+            return info;
+        }
+
+        static thread_local std::vector<Part> parts;
+        static thread_local std::vector<PartContact> found;
+        parts.clear();
+        found.clear();
+        fromShape(info.b)->queryParts(info.a->bb, parts);
+
+        for (auto& part : parts)
+        {
+            cpHashValue hashid = CP_HASH_PAIR(info.b->hashid, part.id);
+            struct cpContact partContacts[CP_MAX_CONTACTS_PER_ARBITER];
+            struct cpCollisionInfo partInfo = cpCollide(info.a, partShape(part, hashid), 0, partContacts);
+
+            // cpCollide() may have put the part first, the normal must point from the regular shape to the part.
+            bool flipped = (partInfo.a != info.a);
+            for (int i = 0; i < partInfo.count; i++)
+            {
+                PartContact c;
+                c.contact = partContacts[i];
+                if (flipped)
+                {
+                    std::swap(c.contact.r1, c.contact.r2);
+                }
+                c.contact.hash = CP_HASH_PAIR(c.contact.hash, hashid);
+                c.normal = flipped ? cpvneg(partInfo.n) : partInfo.n;
+                c.depth = cpvdot(cpvsub(c.contact.r2, c.contact.r1), c.normal);
+                found.push_back(c);
+            }
+        }
+        if (found.empty())
+        {
+            return info;
+        }
+
+        // An arbiter has a single normal, take the deepest contact's and the contact furthest from it along a
+        // similar normal, so a shape resting across several parts stays supported at both ends.
+        auto deepest = std::min_element(found.begin(), found.end(),
+                                        [](const PartContact& l, const PartContact& r) { return l.depth < r.depth; });
+        info.n = deepest->normal;
+        contacts[0] = deepest->contact;
+        info.count = 1;
+
+        const PartContact* second = nullptr;
+        cpFloat secondDistance = 0.0f;
+        for (auto& c : found)
+        {
+            cpFloat distance = cpvdistsq(c.contact.r1, contacts[0].r1);
+            if (&c != &*deepest && cpvdot(c.normal, info.n) > 0.7f && distance > secondDistance)
+            {
+                second = &c;
+                secondDistance = distance;
+            }
+        }
+        if (second && secondDistance > MAGIC_EPSILON)
+        {
+            contacts[1] = second->contact;
+            info.count = 2;
+        }
+        return info;
+    }
+}
@@ -11,4 +11,16 @@ namespace Chipmunk
     Constraint(cpDampedRotarySpringNew(*bodyA, *bodyB, restAngle, stiffness, damping),
                bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> DampedRotarySpring::clone(std::shared_ptr<Body> bodyA,
+                                                          std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<DampedRotarySpring>(bodyA, bodyB,
+                                                          cpDampedRotarySpringGetRestAngle(_constraint),
+                                                          cpDampedRotarySpringGetStiffness(_constraint),
+                                                          cpDampedRotarySpringGetDamping(_constraint));
+        cpDampedRotarySpringSetSpringTorqueFunc(*joint, cpDampedRotarySpringGetSpringTorqueFunc(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
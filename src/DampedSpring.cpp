@@ -13,4 +13,18 @@ namespace Chipmunk
     Constraint(cpDampedSpringNew(*bodyA, *bodyB, anchorA, anchorB, restLength, stiffness, damping),
                bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> DampedSpring::clone(std::shared_ptr<Body> bodyA,
+                                                    std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<DampedSpring>(bodyA, bodyB,
+                                                    cpDampedSpringGetAnchorA(_constraint),
+                                                    cpDampedSpringGetAnchorB(_constraint),
+                                                    cpDampedSpringGetRestLength(_constraint),
+                                                    cpDampedSpringGetStiffness(_constraint),
+                                                    cpDampedSpringGetDamping(_constraint));
+        cpDampedSpringSetSpringForceFunc(*joint, cpDampedSpringGetSpringForceFunc(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
@@ -0,0 +1,169 @@
+#include "FixedStepper.h"
+#include "Space.h"
+#include "Body.h"
+extern "C" {
+#include <chipmunk_private.h>
+}
+#include <algorithm>
+#include <cmath>
+
+namespace Chipmunk
+{
+    FixedStepper::FixedStepper(Space& space, cpFloat timeStep, int maxSteps) :
+    _space(space),
+    _timeStep(timeStep),
+    _maxSteps(maxSteps),
+    _accumulator(0.0f)
+    {
+        setMaxSteps(maxSteps);
+        reset();
+    }
+    
+    void FixedStepper::setMaxSteps(int maxSteps)
+    {
+        cpAssertHard(maxSteps > 0, "A fixed stepper must be allowed at least one step per update.");
+        _maxSteps = maxSteps;
+    }
+    
+    void FixedStepper::TransformArrays::resize(size_t count)
+    {
+        x.resize(count);
+        y.resize(count);
+        cos.resize(count);
+        sin.resize(count);
+        cogX.resize(count);
+        cogY.resize(count);
+    }
+    
+    void FixedStepper::capture(TransformArrays& arrays)
+    {
+        const auto& bodies = _space.getBodies();
+        arrays.resize(bodies.size());
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            const cpBody* body = *bodies[i];
+            arrays.x[i] = body->p.x;
+            arrays.y[i] = body->p.y;
+            arrays.cos[i] = body->transform.a;
+            arrays.sin[i] = body->transform.b;
+            arrays.cogX[i] = body->cog.x;
+            arrays.cogY[i] = body->cog.y;
+        }
+    }
+    
+    bool FixedStepper::bodiesChanged() const
+    {
+        const auto& bodies = _space.getBodies();
+        if (bodies.size() != _bodies.size())
+        {
+            return true;
+        }
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            if (*bodies[i] != _bodies[i])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void FixedStepper::reset()
+    {
+        const auto& bodies = _space.getBodies();
+        _bodies.resize(bodies.size());
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            _bodies[i] = *bodies[i];
+        }
+        capture(_current);
+        _previous = _current;
+    }
+    
+    int FixedStepper::update(cpFloat frameTime)
+    {
+        _accumulator += frameTime;
+        int steps = std::min(static_cast<int>(std::floor(_accumulator/_timeStep)), _maxSteps);
+        if (steps <= 0)
+        {
+            return 0;
+        }
+        
+        for (int i = 0; i < steps - 1; i++)
+        {
+            _space.step(_timeStep);
+        }
+        // Only the state before the final step is needed to interpolate towards the current state.
+        if (bodiesChanged())
+        {
+            reset();
+        }
+        else
+        {
+            capture(_previous);
+        }
+        _space.step(_timeStep);
+        if (bodiesChanged())
+        {
+            reset();
+        }
+        else
+        {
+            capture(_current);
+        }
+        
+        _accumulator -= steps*_timeStep;
+        if (_accumulator >= _timeStep)
+        {
+            // Clamped by maxSteps, drop the whole steps that didn't fit and keep the fraction.
+            _accumulator = std::fmod(_accumulator, _timeStep);
+        }
+        return steps;
+    }
+    
+    const std::vector<cpTransform>& FixedStepper::interpolate(cpFloat alpha)
+    {
+        if (bodiesChanged())
+        {
+            reset();
+        }
+        
+        const size_t count = _bodies.size();
+        _transforms.resize(count);
+        
+        const cpFloat t = cpfclamp01(alpha);
+        const cpFloat* px = _previous.x.data();
+        const cpFloat* py = _previous.y.data();
+        const cpFloat* pc = _previous.cos.data();
+        const cpFloat* ps = _previous.sin.data();
+        const cpFloat* cx = _current.x.data();
+        const cpFloat* cy = _current.y.data();
+        const cpFloat* cc = _current.cos.data();
+        const cpFloat* cs = _current.sin.data();
+        const cpFloat* gx = _current.cogX.data();
+        const cpFloat* gy = _current.cogY.data();
+        cpTransform* out = _transforms.data();
+        
+        // Branch free loop over flat arrays so the compiler can vectorize it.
+        // Rotations are blended with a normalized lerp, which is accurate for the small rotation of a single step.
+        for (size_t i = 0; i < count; i++)
+        {
+            cpFloat x = px[i] + (cx[i] - px[i])*t;
+            cpFloat y = py[i] + (cy[i] - py[i])*t;
+            cpFloat c = pc[i] + (cc[i] - pc[i])*t;
+            cpFloat s = ps[i] + (cs[i] - ps[i])*t;
+            cpFloat invLength = 1.0f/std::sqrt(cpfmax(c*c + s*s, 1e-12f));
+            c *= invLength;
+            s *= invLength;
+            
+            // Same layout as cpBody's transform, which places the center of gravity at the body position.
+            out[i].a = c;
+            out[i].b = s;
+            out[i].c = -s;
+            out[i].d = c;
+            out[i].tx = x - (gx[i]*c - gy[i]*s);
+            out[i].ty = y - (gx[i]*s + gy[i]*c);
+        }
+        return _transforms;
+    }
+}
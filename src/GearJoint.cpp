@@ -10,4 +10,14 @@ namespace Chipmunk
     Constraint(cpGearJointNew(*bodyA, *bodyB, phase, ratio),
     bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> GearJoint::clone(std::shared_ptr<Body> bodyA,
+                                                 std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<GearJoint>(bodyA, bodyB,
+                                                 cpGearJointGetPhase(_constraint),
+                                                 cpGearJointGetRatio(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
@@ -11,4 +11,15 @@ namespace Chipmunk
     Constraint(cpGrooveJointNew(*bodyA, *bodyB, groove_a, groove_b, anchorB),
                bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> GrooveJoint::clone(std::shared_ptr<Body> bodyA,
+                                                   std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<GrooveJoint>(bodyA, bodyB,
+                                                   cpGrooveJointGetGrooveA(_constraint),
+                                                   cpGrooveJointGetGrooveB(_constraint),
+                                                   cpGrooveJointGetAnchorB(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
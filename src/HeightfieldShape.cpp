@@ -0,0 +1,221 @@
+#include "HeightfieldShape.h"
+#include "Body.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Chipmunk
+{
+    HeightfieldShape::HeightfieldShape(std::shared_ptr<Body> body,
+                                       const std::vector<cpFloat>& heights,
+                                       cpFloat spacing,
+                                       cpVect origin,
+                                       cpFloat radius) :
+    CustomShape(body),
+    _heights(heights),
+    _spacing(spacing),
+    _origin(origin),
+    _radius(radius),
+    _hasPrev(false),
+    _hasNext(false),
+    _prevHeight(0.0f),
+    _nextHeight(0.0f)
+    {
+        cpAssertHard(heights.size() >= 2, "A heightfield needs at least two samples.");
+        cpAssertHard(spacing > 0.0f, "Heightfield spacing must be positive.");
+        auto range = std::minmax_element(heights.begin(), heights.end());
+        _minHeight = *range.first;
+        _maxHeight = *range.second;
+    }
+
+    std::shared_ptr<Shape> HeightfieldShape::clone(std::shared_ptr<Body> body) const
+    {
+        auto shape = std::make_shared<HeightfieldShape>(body, _heights, _spacing, _origin, _radius);
+        shape->_hasPrev = _hasPrev;
+        shape->_hasNext = _hasNext;
+        shape->_prevHeight = _prevHeight;
+        shape->_nextHeight = _nextHeight;
+        copyProperties(*shape);
+        return shape;
+    }
+
+    std::vector<std::shared_ptr<HeightfieldShape>> HeightfieldShape::createChunks(std::shared_ptr<Body> body,
+                                                                                  const std::vector<cpFloat>& heights,
+                                                                                  cpFloat spacing,
+                                                                                  size_t columns,
+                                                                                  cpVect origin,
+                                                                                  cpFloat radius)
+    {
+        cpAssertHard(columns > 0, "Chunks need at least one column.");
+        std::vector<std::shared_ptr<HeightfieldShape>> chunks;
+        for (size_t start = 0; start + 1 < heights.size(); start += columns)
+        {
+            size_t end = std::min(start + columns, heights.size() - 1);
+            std::vector<cpFloat> slice(heights.begin() + start, heights.begin() + end + 1);
+            auto chunk = std::make_shared<HeightfieldShape>(body, slice, spacing,
+                                                            cpv(origin.x + start*spacing, origin.y), radius);
+            chunk->_hasPrev = start > 0;
+            chunk->_prevHeight = chunk->_hasPrev ? heights[start - 1] : 0.0f;
+            chunk->_hasNext = end + 1 < heights.size();
+            chunk->_nextHeight = chunk->_hasNext ? heights[end + 1] : 0.0f;
+            chunks.push_back(chunk);
+        }
+        return chunks;
+    }
+
+    int HeightfieldShape::columnCount() const
+    {
+        return static_cast<int>(_heights.size()) - 1;
+    }
+
+    int HeightfieldShape::columnAt(cpFloat x) const
+    {
+        cpFloat column = std::floor((x - _origin.x)/_spacing);
+        return static_cast<int>(cpfclamp(column, 0.0f, static_cast<cpFloat>(columnCount() - 1)));
+    }
+
+    cpVect HeightfieldShape::sample(int i) const
+    {
+        cpFloat height;
+        if (i < 0)
+        {
+            height = _prevHeight;
+        }
+        else if (i > columnCount())
+        {
+            height = _nextHeight;
+        }
+        else
+        {
+            height = _heights[i];
+        }
+        return cpv(_origin.x + i*_spacing, _origin.y + height);
+    }
+
+    cpFloat HeightfieldShape::heightAt(cpFloat x) const
+    {
+        int column = columnAt(x);
+        cpFloat t = cpfclamp01((x - _origin.x)/_spacing - column);
+        return _origin.y + cpflerp(_heights[column], _heights[column + 1], t);
+    }
+
+    void HeightfieldShape::columnPart(int column, Part& part) const
+    {
+        part.id = static_cast<cpHashValue>(column);
+        part.count = 2;
+        part.verts[0] = sample(column);
+        part.verts[1] = sample(column + 1);
+        part.radius = _radius;
+        // Ends without a neighbour get a zero tangent, which never rejects a contact.
+        part.hasNeighbors = true;
+        part.prev = (column > 0 || _hasPrev) ? sample(column - 1) : part.verts[0];
+        part.next = (column + 1 < columnCount() || _hasNext) ? sample(column + 2) : part.verts[1];
+    }
+
+    cpBB HeightfieldShape::localBounds() const
+    {
+        return cpBBNew(_origin.x - _radius, _origin.y + _minHeight - _radius,
+                       _origin.x + columnCount()*_spacing + _radius, _origin.y + _maxHeight + _radius);
+    }
+
+    void HeightfieldShape::localParts(cpBB bb, std::vector<Part>& parts) const
+    {
+        if (!cpBBIntersects(bb, localBounds()))
+        {
+            return;
+        }
+        int first = columnAt(bb.l - _radius);
+        int last = columnAt(bb.r + _radius);
+        for (int column = first; column <= last; column++)
+        {
+            cpFloat a = _origin.y + _heights[column];
+            cpFloat b = _origin.y + _heights[column + 1];
+            if (cpfmin(a, b) - _radius > bb.t || cpfmax(a, b) + _radius < bb.b)
+            {
+                continue;
+            }
+            parts.push_back(Part());
+            columnPart(column, parts.back());
+        }
+    }
+
+    bool HeightfieldShape::localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const
+    {
+        cpFloat reach = radius + _radius;
+        cpBB bounds = localBounds();
+        if (!cpBBIntersects(cpBBNew(cpfmin(a.x, b.x) - radius, cpfmin(a.y, b.y) - radius,
+                                    cpfmax(a.x, b.x) + radius, cpfmax(a.y, b.y) + radius), bounds))
+        {
+            return false;
+        }
+
+        // Walk the columns in the direction of the query, stopping once they start beyond the best hit.
+        cpFloat dx = b.x - a.x;
+        int first = columnAt(cpfmin(a.x, b.x) - reach);
+        int last = columnAt(cpfmax(a.x, b.x) + reach);
+        int step = dx >= 0.0f ? 1 : -1;
+        int begin = step > 0 ? first : last;
+        int end = step > 0 ? last + step : first + step;
+
+        bool found = false;
+        Part part;
+        for (int column = begin; column != end; column += step)
+        {
+            if (found && dx != 0.0f)
+            {
+                cpFloat nearX = _origin.x + (step > 0 ? column : column + 1)*_spacing - step*reach;
+                if ((nearX - a.x)/dx > info->alpha)
+                {
+                    break;
+                }
+            }
+            columnPart(column, part);
+            cpSegmentQueryInfo hit;
+            if (partSegmentQuery(part, a, b, radius, &hit) && hit.alpha < info->alpha)
+            {
+                *info = hit;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    void HeightfieldShape::localPointQuery(cpVect p, cpPointQueryInfo* info) const
+    {
+        // Start under the point and widen while columns could still be closer than the nearest one found.
+        int start = columnAt(p.x);
+        Part part;
+        columnPart(start, part);
+        partPointQuery(part, p, info);
+
+        for (int column = start - 1; column >= 0; column--)
+        {
+            cpFloat gap = p.x - (_origin.x + (column + 1)*_spacing);
+            if (gap - _radius > info->distance)
+            {
+                break;
+            }
+            cpPointQueryInfo nearest;
+            columnPart(column, part);
+            partPointQuery(part, p, &nearest);
+            if (nearest.distance < info->distance)
+            {
+                *info = nearest;
+            }
+        }
+        for (int column = start + 1; column < columnCount(); column++)
+        {
+            cpFloat gap = (_origin.x + column*_spacing) - p.x;
+            if (gap - _radius > info->distance)
+            {
+                break;
+            }
+            cpPointQueryInfo nearest;
+            columnPart(column, part);
+            partPointQuery(part, p, &nearest);
+            if (nearest.distance < info->distance)
+            {
+                *info = nearest;
+            }
+        }
+    }
+}
@@ -0,0 +1,212 @@
+#include "InterestManager.h"
+#include "Space.h"
+#include "Body.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace Chipmunk
+{
+    namespace
+    {
+        /// Upper limit on the number of grid cells, the cell size grows to stay under it.
+        const int MAX_CELLS = 1 << 20;
+
+        struct BodyBounds
+        {
+            cpBB bb;
+            bool empty;
+        };
+
+        void mergeShapeBB(cpBody*, cpShape* shape, BodyBounds* bounds)
+        {
+            cpBB bb = cpShapeGetBB(shape);
+            bounds->bb = bounds->empty ? bb : cpBBMerge(bounds->bb, bb);
+            bounds->empty = false;
+        }
+    }
+
+    InterestManager::InterestManager(const Space& space) :
+    _space(space),
+    _cellSize(0.0f),
+    _gridBounds(cpBBNew(0.0f, 0.0f, 0.0f, 0.0f)),
+    _gridCellSize(1.0f),
+    _columns(0),
+    _rows(0)
+    { }
+
+    void InterestManager::update(const std::vector<cpBB>& areas)
+    {
+        _clients.resize(areas.size());
+        if (areas.empty())
+        {
+            return;
+        }
+
+        {
+            ReadWriteLock::ReadGuard guard(_space.getLock());
+            cpBB bounds = areas[0];
+            for (auto& area : areas)
+            {
+                bounds = cpBBMerge(bounds, area);
+            }
+            gatherEntries(bounds);
+        }
+        buildGrid(areas);
+
+        auto updateClients = [this, &areas](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                updateClient(_clients[i], areas[i]);
+            }
+        };
+        TaskScheduler* scheduler = _space.getScheduler().get();
+        if (scheduler)
+        {
+            scheduler->parallelFor(areas.size(), 1, updateClients);
+            scheduler->wait();
+        }
+        else
+        {
+            updateClients(0, areas.size());
+        }
+    }
+
+    void InterestManager::gatherEntries(cpBB bounds)
+    {
+        _entries.clear();
+        for (auto& body : _space.getBodies())
+        {
+            if (body->getBodyType() == CP_BODY_TYPE_STATIC)
+            {
+                continue;
+            }
+            BodyBounds bodyBounds = { cpBBNew(0.0f, 0.0f, 0.0f, 0.0f), true };
+            cpBodyEachShape(*body, (cpBodyShapeIteratorFunc)mergeShapeBB, &bodyBounds);
+            if (!bodyBounds.empty && cpBBIntersects(bodyBounds.bb, bounds))
+            {
+                Entry entry = { bodyBounds.bb, body };
+                _entries.push_back(entry);
+            }
+        }
+    }
+
+    void InterestManager::cellRange(cpBB bb, int& x0, int& y0, int& x1, int& y1) const
+    {
+        auto column = [this](cpFloat x)
+        {
+            int cell = static_cast<int>(std::floor((x - _gridBounds.l)/_gridCellSize));
+            return std::min(std::max(cell, 0), _columns - 1);
+        };
+        auto row = [this](cpFloat y)
+        {
+            int cell = static_cast<int>(std::floor((y - _gridBounds.b)/_gridCellSize));
+            return std::min(std::max(cell, 0), _rows - 1);
+        };
+        x0 = column(bb.l);
+        x1 = column(bb.r);
+        y0 = row(bb.b);
+        y1 = row(bb.t);
+    }
+
+    void InterestManager::buildGrid(const std::vector<cpBB>& areas)
+    {
+        _gridBounds = areas[0];
+        cpFloat averageSize = 0.0f;
+        for (auto& area : areas)
+        {
+            _gridBounds = cpBBMerge(_gridBounds, area);
+            averageSize += ((area.r - area.l) + (area.t - area.b))*0.5f;
+        }
+        averageSize /= areas.size();
+
+        _gridCellSize = _cellSize > 0.0f ? _cellSize : averageSize;
+        if (_gridCellSize <= 0.0f)
+        {
+            _gridCellSize = 1.0f;
+        }
+        cpFloat width = _gridBounds.r - _gridBounds.l;
+        cpFloat height = _gridBounds.t - _gridBounds.b;
+        while (true)
+        {
+            _columns = std::max(1, static_cast<int>(std::ceil(width/_gridCellSize)));
+            _rows = std::max(1, static_cast<int>(std::ceil(height/_gridCellSize)));
+            if (static_cast<double>(_columns)*_rows <= MAX_CELLS)
+            {
+                break;
+            }
+            _gridCellSize *= 2.0f;
+        }
+
+        // Counting sort of the entries into every cell they overlap.
+        _cellStarts.assign(_columns*_rows + 1, 0);
+        int x0, y0, x1, y1;
+        for (auto& entry : _entries)
+        {
+            cellRange(entry.bb, x0, y0, x1, y1);
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    _cellStarts[y*_columns + x + 1]++;
+                }
+            }
+        }
+        for (size_t i = 1; i < _cellStarts.size(); i++)
+        {
+            _cellStarts[i] += _cellStarts[i - 1];
+        }
+        _cellEntries.resize(_cellStarts.back());
+        std::vector<unsigned> cursors(_cellStarts.begin(), _cellStarts.end() - 1);
+        for (size_t i = 0; i < _entries.size(); i++)
+        {
+            cellRange(_entries[i].bb, x0, y0, x1, y1);
+            for (int y = y0; y <= y1; y++)
+            {
+                for (int x = x0; x <= x1; x++)
+                {
+                    _cellEntries[cursors[y*_columns + x]++] = static_cast<unsigned>(i);
+                }
+            }
+        }
+    }
+
+    void InterestManager::updateClient(Client& client, cpBB area) const
+    {
+        std::swap(client.previous, client.bodies);
+        client.bodies.clear();
+
+        int x0, y0, x1, y1;
+        cellRange(area, x0, y0, x1, y1);
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int x = x0; x <= x1; x++)
+            {
+                int cell = y*_columns + x;
+                for (unsigned i = _cellStarts[cell]; i < _cellStarts[cell + 1]; i++)
+                {
+                    const Entry& entry = _entries[_cellEntries[i]];
+                    if (cpBBIntersects(entry.bb, area))
+                    {
+                        client.bodies.push_back(entry.body);
+                    }
+                }
+            }
+        }
+
+        // Bodies spanning several cells are found once per cell.
+        std::sort(client.bodies.begin(), client.bodies.end());
+        client.bodies.erase(std::unique(client.bodies.begin(), client.bodies.end()), client.bodies.end());
+
+        client.entered.clear();
+        client.left.clear();
+        std::set_difference(client.bodies.begin(), client.bodies.end(),
+                            client.previous.begin(), client.previous.end(),
+                            std::back_inserter(client.entered));
+        std::set_difference(client.previous.begin(), client.previous.end(),
+                            client.bodies.begin(), client.bodies.end(),
+                            std::back_inserter(client.left));
+    }
+}
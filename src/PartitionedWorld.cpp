@@ -0,0 +1,438 @@
+#include "PartitionedWorld.h"
+#include "Space.h"
+#include "Body.h"
+#include "Shape.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Chipmunk
+{
+    PartitionedWorld::PartitionedWorld(cpFloat regionSize, std::shared_ptr<TaskScheduler> scheduler) :
+    _regionSize(regionSize),
+    _ghostMargin(regionSize/8.0f),
+    _scheduler(scheduler)
+    {
+        cpAssertHard(regionSize > 0.0f, "Region size must be positive.");
+    }
+
+    PartitionedWorld::~PartitionedWorld()
+    {
+        // Bodies and shapes may outlive the world, so take them out of the region spaces before those are freed.
+        while (!_entries.empty())
+        {
+            remove(_entries.back()->body);
+        }
+    }
+
+    void PartitionedWorld::configure(std::function<void(Space&)> func)
+    {
+        for (auto& region : _regions)
+        {
+            func(*region.second);
+        }
+        _configure.push_back(func);
+    }
+
+    PartitionedWorld::RegionKey PartitionedWorld::regionKeyFor(cpVect p) const
+    {
+        return RegionKey(static_cast<int>(std::floor(p.x/_regionSize)),
+                         static_cast<int>(std::floor(p.y/_regionSize)));
+    }
+
+    void PartitionedWorld::regionKeysFor(cpBB bb, std::vector<RegionKey>& keys) const
+    {
+        keys.clear();
+        RegionKey min = regionKeyFor(cpv(bb.l, bb.b));
+        RegionKey max = regionKeyFor(cpv(bb.r, bb.t));
+        for (int y = min.second; y <= max.second; y++)
+        {
+            for (int x = min.first; x <= max.first; x++)
+            {
+                keys.push_back(RegionKey(x, y));
+            }
+        }
+    }
+
+    Space* PartitionedWorld::findRegion(const RegionKey& key) const
+    {
+        auto it = _regions.find(key);
+        return it == _regions.end() ? nullptr : it->second.get();
+    }
+
+    Space& PartitionedWorld::regionFor(const RegionKey& key)
+    {
+        Space* found = findRegion(key);
+        if (found)
+        {
+            return *found;
+        }
+
+        Space* space = new Space();
+        _regions[key] = std::unique_ptr<Space>(space);
+        for (auto& func : _configure)
+        {
+            func(*space);
+        }
+
+        // Static bodies already in the world that reach into the new region get a copy in it.
+        std::vector<RegionKey> keys;
+        for (auto& entry : _entries)
+        {
+            if (!entry->isStatic || entry->home == key)
+            {
+                continue;
+            }
+            regionKeysFor(boundsFor(*entry), keys);
+            if (std::find(keys.begin(), keys.end(), key) != keys.end())
+            {
+                addGhost(*entry, key);
+            }
+        }
+        return *space;
+    }
+
+    Space& PartitionedWorld::getRegion(cpVect p)
+    {
+        return regionFor(regionKeyFor(p));
+    }
+
+    cpBB PartitionedWorld::boundsFor(const Entry& entry) const
+    {
+        cpVect p = entry.body->getPosition();
+        cpBB bb = cpBBNew(p.x, p.y, p.x, p.y);
+        for (auto& shape : entry.shapes)
+        {
+            bb = cpBBMerge(bb, cpShapeGetBB(*shape));
+        }
+        return bb;
+    }
+
+    void PartitionedWorld::add(std::shared_ptr<Body> body, const std::vector<std::shared_ptr<Shape>>& shapes)
+    {
+        cpAssertHard(_entryIndices.find(body.get()) == _entryIndices.end(), "The body is already in the world.");
+
+        Entry* entry = new Entry();
+        entry->body = body;
+        entry->shapes = shapes;
+        entry->isStatic = body->getBodyType() == CP_BODY_TYPE_STATIC;
+        for (auto& shape : shapes)
+        {
+            cpShapeCacheBB(*shape);
+        }
+        entry->home = regionKeyFor(entry->isStatic ? cpBBCenter(boundsFor(*entry)) : body->getPosition());
+
+        Space& space = regionFor(entry->home);
+        space.add(body);
+        for (auto& shape : shapes)
+        {
+            space.add(shape);
+        }
+
+        _entryIndices[body.get()] = _entries.size();
+        _entries.push_back(std::unique_ptr<Entry>(entry));
+        updateGhosts(*entry);
+    }
+
+    void PartitionedWorld::remove(std::shared_ptr<Body> body)
+    {
+        auto it = _entryIndices.find(body.get());
+        if (it == _entryIndices.end())
+        {
+            return;
+        }
+        size_t index = it->second;
+        Entry& entry = *_entries[index];
+
+        for (auto& ghost : entry.ghosts)
+        {
+            removeGhost(ghost);
+        }
+        Space* space = findRegion(entry.home);
+        for (auto& shape : entry.shapes)
+        {
+            space->remove(shape);
+        }
+        space->remove(entry.body);
+
+        _entryIndices.erase(it);
+        if (index + 1 != _entries.size())
+        {
+            _entries[index] = std::move(_entries.back());
+            _entryIndices[_entries[index]->body.get()] = index;
+        }
+        _entries.pop_back();
+    }
+
+    void PartitionedWorld::addGhost(Entry& entry, const RegionKey& key)
+    {
+        Space& space = regionFor(key);
+
+        Ghost ghost;
+        ghost.key = key;
+        ghost.body = entry.body->clone();
+        if (!entry.isStatic)
+        {
+            // Ghosts push the bodies of their region but are only moved by the body they copy.
+            ghost.body->setBodyType(CP_BODY_TYPE_KINEMATIC);
+        }
+        space.add(ghost.body);
+        for (auto& shape : entry.shapes)
+        {
+            auto copy = shape->clone(ghost.body);
+            space.add(copy);
+            ghost.shapes.push_back(copy);
+            _ghostOwners[copy.get()] = shape;
+        }
+        entry.ghosts.push_back(ghost);
+    }
+
+    void PartitionedWorld::removeGhost(Ghost& ghost)
+    {
+        Space* space = findRegion(ghost.key);
+        for (auto& shape : ghost.shapes)
+        {
+            space->remove(shape);
+            _ghostOwners.erase(shape.get());
+        }
+        space->remove(ghost.body);
+    }
+
+    void PartitionedWorld::updateGhosts(Entry& entry)
+    {
+        cpFloat margin = entry.isStatic ? 0.0f : _ghostMargin;
+        cpBB bb = boundsFor(entry);
+        regionKeysFor(cpBBNew(bb.l - margin, bb.b - margin, bb.r + margin, bb.t + margin), _keys);
+
+        auto& ghosts = entry.ghosts;
+        for (size_t i = ghosts.size(); i-- > 0;)
+        {
+            if (ghosts[i].key == entry.home || std::find(_keys.begin(), _keys.end(), ghosts[i].key) == _keys.end())
+            {
+                removeGhost(ghosts[i]);
+                ghosts.erase(ghosts.begin() + i);
+            }
+        }
+        for (auto& key : _keys)
+        {
+            auto hasGhost = [&key](const Ghost& ghost) { return ghost.key == key; };
+            if (key == entry.home || std::find_if(ghosts.begin(), ghosts.end(), hasGhost) != ghosts.end())
+            {
+                continue;
+            }
+            if (entry.isStatic && !findRegion(key))
+            {
+                // Static bodies don't create regions, they are copied into a region when it is created.
+                continue;
+            }
+            // Creating the region can add a static entry's ghost to it, so check again after.
+            regionFor(key);
+            if (std::find_if(ghosts.begin(), ghosts.end(), hasGhost) == ghosts.end())
+            {
+                addGhost(entry, key);
+            }
+        }
+
+        if (entry.isStatic)
+        {
+            return;
+        }
+        cpVect position = entry.body->getPosition();
+        cpFloat angle = entry.body->getAngle();
+        cpVect velocity = entry.body->getVelocity();
+        cpFloat angularVelocity = entry.body->getAngularVelocity();
+        for (auto& ghost : ghosts)
+        {
+            ghost.body->setPosition(position);
+            ghost.body->setAngle(angle);
+            ghost.body->setVelocity(velocity);
+            ghost.body->setAngularVelocity(angularVelocity);
+        }
+    }
+
+    void PartitionedWorld::migrate(Entry& entry)
+    {
+        if (entry.isStatic)
+        {
+            return;
+        }
+        RegionKey key = regionKeyFor(entry.body->getPosition());
+        if (key == entry.home)
+        {
+            return;
+        }
+
+        Space* from = findRegion(entry.home);
+        for (auto& shape : entry.shapes)
+        {
+            from->remove(shape);
+        }
+        from->remove(entry.body);
+
+        Space& to = regionFor(key);
+        auto& ghosts = entry.ghosts;
+        for (size_t i = 0; i < ghosts.size(); i++)
+        {
+            if (ghosts[i].key == key)
+            {
+                removeGhost(ghosts[i]);
+                ghosts.erase(ghosts.begin() + i);
+                break;
+            }
+        }
+        to.add(entry.body);
+        for (auto& shape : entry.shapes)
+        {
+            to.add(shape);
+        }
+        entry.home = key;
+    }
+
+    void PartitionedWorld::step(cpFloat dt)
+    {
+        _stepList.clear();
+        for (auto& region : _regions)
+        {
+            _stepList.push_back(region.second.get());
+        }
+
+        Space** spaces = _stepList.data();
+        auto stepRegions = [spaces, dt](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                spaces[i]->step(dt);
+            }
+        };
+        if (_scheduler)
+        {
+            _scheduler->parallelFor(_stepList.size(), 1, stepRegions);
+            _scheduler->wait();
+        }
+        else
+        {
+            stepRegions(0, _stepList.size());
+        }
+
+        // Bodies only move between spaces while none of them is stepping.
+        for (auto& entry : _entries)
+        {
+            migrate(*entry);
+            updateGhosts(*entry);
+        }
+        trimRegions();
+    }
+
+    void PartitionedWorld::trimRegions()
+    {
+        // A region is needed while a body lives in it or a moving body reaches into it. Copies of static bodies
+        // reaching into a region don't keep it, regionFor() adds them again if it is created later.
+        std::map<RegionKey, size_t> managed;
+        std::map<RegionKey, bool> needed;
+        for (auto& entry : _entries)
+        {
+            managed[entry->home]++;
+            needed[entry->home] = true;
+            for (auto& ghost : entry->ghosts)
+            {
+                managed[ghost.key]++;
+                needed[ghost.key] = needed[ghost.key] || !entry->isStatic;
+            }
+        }
+        for (auto region = _regions.begin(); region != _regions.end();)
+        {
+            const RegionKey& key = region->first;
+            // Regions holding bodies added directly through getRegion() are kept as well.
+            if (needed[key] || region->second->getBodies().size() > managed[key])
+            {
+                ++region;
+                continue;
+            }
+            for (auto& entry : _entries)
+            {
+                auto& ghosts = entry->ghosts;
+                for (size_t i = ghosts.size(); i-- > 0;)
+                {
+                    if (ghosts[i].key == key)
+                    {
+                        removeGhost(ghosts[i]);
+                        ghosts.erase(ghosts.begin() + i);
+                    }
+                }
+            }
+            region = _regions.erase(region);
+        }
+    }
+
+    std::shared_ptr<Shape> PartitionedWorld::ownerOf(const std::shared_ptr<Shape>& shape) const
+    {
+        auto it = _ghostOwners.find(shape.get());
+        return it == _ghostOwners.end() ? shape : it->second;
+    }
+
+    std::shared_ptr<Shape> PartitionedWorld::pointQueryNearest(cpVect p, LayerMask layers, cpGroup group,
+                                                               cpFloat maxDistance) const
+    {
+        std::vector<RegionKey> keys;
+        regionKeysFor(cpBBNewForCircle(p, cpfmax(maxDistance, 0.0f)), keys);
+
+        std::shared_ptr<Shape> nearest;
+        cpFloat nearestDistance = INFINITY;
+        for (auto& key : keys)
+        {
+            Space* space = findRegion(key);
+            if (!space)
+            {
+                continue;
+            }
+            auto shape = space->pointQueryNearest(p, layers, group, maxDistance);
+            if (!shape)
+            {
+                continue;
+            }
+            cpPointQueryInfo info;
+            cpShapePointQuery(*shape, p, &info);
+            if (info.distance < nearestDistance)
+            {
+                nearestDistance = info.distance;
+                nearest = ownerOf(shape);
+            }
+        }
+        return nearest;
+    }
+
+    std::shared_ptr<Shape> PartitionedWorld::segmentQueryFirst(cpVect a, cpVect b, cpFloat radius,
+                                                               LayerMask layers, cpGroup group,
+                                                               cpSegmentQueryInfo* const info) const
+    {
+        std::vector<RegionKey> keys;
+        regionKeysFor(cpBBNew(cpfmin(a.x, b.x) - radius, cpfmin(a.y, b.y) - radius,
+                              cpfmax(a.x, b.x) + radius, cpfmax(a.y, b.y) + radius), keys);
+
+        std::shared_ptr<Shape> first;
+        cpSegmentQueryInfo best = { nullptr, b, cpvzero, 1.0f };
+        for (auto& key : keys)
+        {
+            cpBB bounds = cpBBNew(key.first*_regionSize - radius, key.second*_regionSize - radius,
+                                  (key.first + 1)*_regionSize + radius, (key.second + 1)*_regionSize + radius);
+            Space* space = findRegion(key);
+            if (!space || !cpBBIntersectsSegment(bounds, a, b))
+            {
+                continue;
+            }
+            cpSegmentQueryInfo hit;
+            auto shape = space->segmentQueryFirst(a, b, radius, layers, group, &hit);
+            if (shape && hit.alpha < best.alpha)
+            {
+                best = hit;
+                first = ownerOf(shape);
+                best.shape = *first;
+            }
+        }
+        if (info)
+        {
+            *info = best;
+        }
+        return first;
+    }
+}
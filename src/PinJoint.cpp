@@ -10,4 +10,15 @@ namespace Chipmunk
     Constraint(cpPinJointNew(*bodyA, *bodyB, anchorA, anchorB),
                bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> PinJoint::clone(std::shared_ptr<Body> bodyA,
+                                                std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<PinJoint>(bodyA, bodyB,
+                                                cpPinJointGetAnchorA(_constraint),
+                                                cpPinJointGetAnchorB(_constraint));
+        cpPinJointSetDist(*joint, cpPinJointGetDist(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
@@ -17,4 +17,14 @@ namespace Chipmunk
     Constraint(cpPivotJointNew2(*bodyA, *bodyB, anchorA, anchorB),
                bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> PivotJoint::clone(std::shared_ptr<Body> bodyA,
+                                                  std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<PivotJoint>(bodyA, bodyB,
+                                                  cpPivotJointGetAnchorA(_constraint),
+                                                  cpPivotJointGetAnchorB(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
@@ -1,13 +1,125 @@
 #include "PolyShape.h"
 #include "Body.h"
+#include "PolyShapeTemplate.h"
+#include <chipmunk_unsafe.h>
 
 namespace Chipmunk
 {
     PolyShape::PolyShape(std::shared_ptr<Body> body, const std::vector<cpVect>& verts)
-    : Shape(cpPolyShapeNewRaw(*body,
-                              static_cast<int>(verts.size()),
-                              const_cast<cpVect*>(reinterpret_cast<const cpVect*>(&verts[0])),
-                              0),
-            body)
+    : Shape(cpPolyShapeNewRaw(body ? (*body) : (cpBody*)0, static_cast<int>(verts.size()), &verts[0], 0), body)
     { }
+    
+    PolyShape::PolyShape(std::shared_ptr<Body> body,
+                         const cpVect* verts,
+                         int count,
+                         cpTransform transform,
+                         cpFloat radius,
+                         cpFloat tolerance)
+    : Shape(newHull(body ? (*body) : (cpBody*)0, verts, verts + count, transform, radius, tolerance), body)
+    { }
+    
+    PolyShape::PolyShape(std::shared_ptr<Body> body, std::shared_ptr<const PolyShapeTemplate> polyTemplate)
+    : Shape(polyTemplate->newShape(body ? (*body) : (cpBody*)0), body),
+    _template(polyTemplate)
+    { }
+    
+    PolyShape::PolyShape(cpShape* shape, std::shared_ptr<Body> body)
+    : Shape(shape, body)
+    { }
+    
+    cpShape* PolyShape::newHullInPlace(cpBody* body, cpVect* verts, int count, cpFloat radius, cpFloat tolerance)
+    {
+        int hullCount = cpConvexHull(count, verts, verts, NULL, tolerance);
+        return cpPolyShapeNewRaw(body, hullCount, verts, radius);
+    }
+    
+    cpVect* PolyShape::scratchVerts(int count)
+    {
+        // Vertex counts come from the caller, so they're kept off the stack.
+        static thread_local std::vector<cpVect> verts;
+        verts.resize(static_cast<size_t>(count));
+        return verts.data();
+    }
+    
+    std::shared_ptr<PolyShape> PolyShape::createBox(std::shared_ptr<Body> body, cpFloat width, cpFloat height, cpFloat radius)
+    {
+        return std::shared_ptr<PolyShape>(new PolyShape(cpBoxShapeNew(body ? (*body) : (cpBody*)0, width, height, radius),
+                                                        body));
+    }
+    
+    std::shared_ptr<PolyShape> PolyShape::createBox(std::shared_ptr<Body> body, cpBB box, cpFloat radius)
+    {
+        return std::shared_ptr<PolyShape>(new PolyShape(cpBoxShapeNew2(body ? (*body) : (cpBody*)0, box, radius),
+                                                        body));
+    }
+    
+    std::shared_ptr<PolyShape> PolyShape::createRoundedBox(std::shared_ptr<Body> body, cpFloat width, cpFloat height, cpFloat radius)
+    {
+        cpAssertHard(2.0f*radius < width && 2.0f*radius < height, "Corner radius is too large for the box.");
+        return createBox(body, width - 2.0f*radius, height - 2.0f*radius, radius);
+    }
+    
+    void PolyShape::setVerts(const cpVect* verts, int count, cpTransform transform, bool update)
+    {
+        cpAssertHard(count >= 1, "A polygon needs at least one vert.");
+        cpVect* hull = scratchVerts(count);
+        for (int i = 0; i < count; i++)
+        {
+            hull[i] = cpTransformPoint(transform, verts[i]);
+        }
+        int hullCount = cpConvexHull(count, hull, hull, NULL, 0.0f);
+        if (_template)
+        {
+            // Template instances are allocated with room for exactly their own planes.
+            cpAssertHard(hullCount == cpPolyShapeGetCount(_shape), "Template instances can't change their vertex count.");
+            _template.reset();
+        }
+        cpPolyShapeSetVertsRaw(_shape, hullCount, hull);
+        if (update)
+        {
+            geometryChanged();
+        }
+    }
+    
+    void PolyShape::setRadius(cpFloat radius, bool update)
+    {
+        // cpPolyShapeSetRadius() leaves the mass info alone, setting the same verts again recomputes it with the radius.
+        int count = cpPolyShapeGetCount(_shape);
+        cpVect* verts = scratchVerts(count);
+        for (int i = 0; i < count; i++)
+        {
+            verts[i] = cpPolyShapeGetVert(_shape, i);
+        }
+        cpPolyShapeSetRadius(_shape, radius);
+        cpPolyShapeSetVertsRaw(_shape, count, verts);
+        _template.reset();
+        if (update)
+        {
+            geometryChanged();
+        }
+    }
+    
+    std::shared_ptr<Shape> PolyShape::clone(std::shared_ptr<Body> body) const
+    {
+        if (_template)
+        {
+            auto shape = std::make_shared<PolyShape>(body, _template);
+            copyProperties(*shape);
+            return shape;
+        }
+        // The stored vertexes are already a hull, copy them without going through cpConvexHull again.
+        int count = cpPolyShapeGetCount(_shape);
+        cpVect* verts = scratchVerts(count);
+        for (int i = 0; i < count; i++)
+        {
+            verts[i] = cpPolyShapeGetVert(_shape, i);
+        }
+        std::shared_ptr<PolyShape> shape(new PolyShape(cpPolyShapeNewRaw(body ? (*body) : (cpBody*)0,
+                                                                          count,
+                                                                          verts,
+                                                                          cpPolyShapeGetRadius(_shape)),
+                                                       body));
+        copyProperties(*shape);
+        return shape;
+    }
 }
@@ -0,0 +1,47 @@
+#include "PolyShapeTemplate.h"
+extern "C" {
+#include <chipmunk_private.h>
+}
+#include <cstddef>
+#include <cstring>
+
+namespace Chipmunk
+{
+    PolyShapeTemplate::PolyShapeTemplate(const std::vector<cpVect>& verts, cpFloat radius)
+    {
+        cpAssertHard(verts.size() >= 3, "A polygon needs at least three verts.");
+        std::vector<cpVect> hull(verts.size());
+        int count = cpConvexHull(static_cast<int>(verts.size()), &verts[0], &hull[0], NULL, 0.0f);
+        _prototype = cpPolyShapeNewRaw(NULL, count, &hull[0], radius);
+    }
+
+    PolyShapeTemplate::~PolyShapeTemplate()
+    {
+        cpShapeFree(_prototype);
+    }
+
+    cpShape* PolyShapeTemplate::newShape(cpBody* body) const
+    {
+        const cpPolyShape* prototype = reinterpret_cast<const cpPolyShape*>(_prototype);
+        int count = prototype->count;
+        size_t planesSize = 2*count*sizeof(struct cpSplittingPlane);
+
+        // Small polygons keep their planes in a truncated copy of the inline storage, larger ones
+        // are allocated separately as Chipmunk frees them in cpPolyShapeDestroy().
+        cpPolyShape* poly;
+        if (count <= CP_POLY_SHAPE_INLINE_ALLOC)
+        {
+            poly = (cpPolyShape*)cpcalloc(1, offsetof(cpPolyShape, _planes) + planesSize);
+            poly->planes = poly->_planes;
+        }
+        else
+        {
+            poly = (cpPolyShape*)cpcalloc(1, offsetof(cpPolyShape, _planes));
+            poly->planes = (struct cpSplittingPlane*)cpcalloc(2*count, sizeof(struct cpSplittingPlane));
+        }
+        poly->r = prototype->r;
+        poly->count = count;
+        memcpy(poly->planes, prototype->planes, planesSize);
+        return cpShapeInit(&poly->shape, _prototype->klass, body, _prototype->massInfo);
+    }
+}
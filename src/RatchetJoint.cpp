@@ -10,4 +10,15 @@ namespace Chipmunk
     Constraint(cpRatchetJointNew(*bodyA, *bodyB, phase, ratchet),
     bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> RatchetJoint::clone(std::shared_ptr<Body> bodyA,
+                                                    std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<RatchetJoint>(bodyA, bodyB,
+                                                    cpRatchetJointGetPhase(_constraint),
+                                                    cpRatchetJointGetRatchet(_constraint));
+        cpRatchetJointSetAngle(*joint, cpRatchetJointGetAngle(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
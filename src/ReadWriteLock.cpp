@@ -0,0 +1,91 @@
+#include "ReadWriteLock.h"
+
+namespace Chipmunk
+{
+    ReadWriteLock::ReadWriteLock() :
+    _state(0),
+    _writer(std::thread::id()),
+    _writeDepth(0),
+    _waitingWriters(0)
+    { }
+    
+    namespace
+    {
+        /// Read locks held by this thread, on any lock.
+        thread_local int readDepth = 0;
+    }
+    
+    bool ReadWriteLock::isWriter() const
+    {
+        return _writer.load(std::memory_order_relaxed) == std::this_thread::get_id();
+    }
+    
+    void ReadWriteLock::lockShared()
+    {
+        if (isWriter())
+        {
+            // The writer already excludes everyone else.
+            return;
+        }
+        // Counted across all locks, a thread reading one lock may get ahead of writers waiting on another.
+        bool nested = readDepth > 0;
+        int state = _state.load(std::memory_order_relaxed);
+        while (true)
+        {
+            bool writerWaiting = !nested && _waitingWriters.load(std::memory_order_relaxed) > 0;
+            if (state >= 0 && !writerWaiting && _state.compare_exchange_weak(state, state + 1,
+                                                                             std::memory_order_acquire,
+                                                                             std::memory_order_relaxed))
+            {
+                readDepth++;
+                return;
+            }
+            if (state < 0 || writerWaiting)
+            {
+                std::this_thread::yield();
+                state = _state.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    
+    void ReadWriteLock::unlockShared()
+    {
+        if (isWriter())
+        {
+            return;
+        }
+        readDepth--;
+        _state.fetch_sub(1, std::memory_order_release);
+    }
+    
+    void ReadWriteLock::lock()
+    {
+        if (isWriter())
+        {
+            _writeDepth++;
+            return;
+        }
+        _waitingWriters.fetch_add(1, std::memory_order_relaxed);
+        int expected = 0;
+        while (!_state.compare_exchange_weak(expected, -1,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed))
+        {
+            expected = 0;
+            std::this_thread::yield();
+        }
+        _waitingWriters.fetch_sub(1, std::memory_order_relaxed);
+        _writer.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        _writeDepth = 1;
+    }
+    
+    void ReadWriteLock::unlock()
+    {
+        if (--_writeDepth > 0)
+        {
+            return;
+        }
+        _writer.store(std::thread::id(), std::memory_order_relaxed);
+        _state.store(0, std::memory_order_release);
+    }
+}
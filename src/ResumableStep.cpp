@@ -0,0 +1,85 @@
+#include "ResumableStep.h"
+#include "Space.h"
+
+namespace Chipmunk
+{
+    ResumableStep::ResumableStep(Space& space) :
+    _space(space),
+    _pipeline(space.getSpace()),
+    _phase(IDLE),
+    _iterations(0)
+    { }
+
+    ResumableStep::~ResumableStep()
+    {
+        finish();
+    }
+
+    bool ResumableStep::start(cpFloat dt)
+    {
+        ReadWriteLock::WriteGuard guard(_space.getLock());
+        cpAssertHard(_phase == IDLE, "A step is already in progress.");
+        cpAssertHard(!cpSpaceIsLocked(_space.getSpace()), "The space can't be stepped during a step or from its callbacks.");
+        _space.beginStep();
+        _pipeline.setScheduler(_space.getScheduler().get());
+        _pipeline.setParallelNarrowphase(_space.getParallelNarrowphase());
+        _space.sweepBullets(dt, _pipeline);
+        if (!_pipeline.begin(dt))
+        {
+            _space.endStep();
+            return false;
+        }
+        _phase = INTEGRATE;
+        return true;
+    }
+
+    bool ResumableStep::advance()
+    {
+        ReadWriteLock::WriteGuard guard(_space.getLock());
+        switch (_phase)
+        {
+            case IDLE:
+                break;
+            case INTEGRATE:
+                _pipeline.integratePositions();
+                _phase = BROADPHASE;
+                break;
+            case BROADPHASE:
+                _pipeline.broadphase();
+                _phase = NARROWPHASE;
+                break;
+            case NARROWPHASE:
+                _pipeline.narrowphase();
+                _phase = PREPARE;
+                break;
+            case PREPARE:
+                _pipeline.processComponents();
+                _pipeline.preStep();
+                _pipeline.integrateVelocities();
+                _pipeline.applyCachedImpulses();
+                _iterations = cpSpaceGetIterations(_space.getSpace());
+                _phase = _iterations > 0 ? SOLVE : CALLBACKS;
+                break;
+            case SOLVE:
+                _pipeline.solve(1);
+                if (--_iterations == 0)
+                {
+                    _phase = CALLBACKS;
+                }
+                break;
+            case CALLBACKS:
+                _pipeline.finish();
+                _space.endStep();
+                _phase = IDLE;
+                break;
+        }
+        return _phase != IDLE;
+    }
+
+    void ResumableStep::finish()
+    {
+        while (advance())
+        {
+        }
+    }
+}
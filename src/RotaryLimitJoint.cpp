@@ -10,4 +10,14 @@ namespace Chipmunk
     Constraint(cpRotaryLimitJointNew(*bodyA, *bodyB, min, max),
                bodyA, bodyB)
     {}
-}
\ No newline at end of file
+    
+    std::shared_ptr<Constraint> RotaryLimitJoint::clone(std::shared_ptr<Body> bodyA,
+                                                        std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<RotaryLimitJoint>(bodyA, bodyB,
+                                                        cpRotaryLimitJointGetMin(_constraint),
+                                                        cpRotaryLimitJointGetMax(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
+}
@@ -1,5 +1,9 @@
 #include "SegmentShape.h"
 #include "Body.h"
+extern "C" {
+#include <chipmunk_private.h>
+}
+#include <chipmunk_unsafe.h>
 
 namespace Chipmunk
 {
@@ -10,6 +14,20 @@ namespace Chipmunk
                                     (cpBody*)NULL, a, b, radius), body)
     { }
     
+    std::shared_ptr<Shape> SegmentShape::clone(std::shared_ptr<Body> body) const
+    {
+        auto shape = std::make_shared<SegmentShape>(body,
+                                                    cpSegmentShapeGetA(_shape),
+                                                    cpSegmentShapeGetB(_shape),
+                                                    cpSegmentShapeGetRadius(_shape));
+        // Neighbor tangents have no public getter, copy them straight from the source segment.
+        const cpSegmentShape* from = reinterpret_cast<const cpSegmentShape*>(_shape);
+        cpSegmentShape* to = reinterpret_cast<cpSegmentShape*>(static_cast<cpShape*>(*shape));
+        to->a_tangent = from->a_tangent;
+        to->b_tangent = from->b_tangent;
+        copyProperties(*shape);
+        return shape;
+    }
     
     void SegmentShape::setNeighbors(std::shared_ptr<Shape> shape,
                                     cpVect prev,
@@ -37,4 +55,22 @@ namespace Chipmunk
     {
         return cpSegmentShapeGetRadius(*shape);
     }
+    
+    void SegmentShape::setEndpoints(cpVect a, cpVect b, bool update)
+    {
+        cpSegmentShapeSetEndpoints(_shape, a, b);
+        if (update)
+        {
+            geometryChanged();
+        }
+    }
+    
+    void SegmentShape::setRadius(cpFloat radius, bool update)
+    {
+        cpSegmentShapeSetRadius(_shape, radius);
+        if (update)
+        {
+            geometryChanged();
+        }
+    }
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+#include "SerialScheduler.h"
+
+namespace Chipmunk
+{
+    unsigned SerialScheduler::getThreadCount() const
+    {
+        return 1;
+    }
+
+    void SerialScheduler::parallelFor(size_t count, size_t, std::function<void(size_t, size_t)> func)
+    {
+        if (count > 0)
+        {
+            func(0, count);
+        }
+    }
+
+    void SerialScheduler::wait()
+    {
+    }
+}
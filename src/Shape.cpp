@@ -1,12 +1,14 @@
 #include "Shape.h"
 #include "Body.h"
 #include "BoundingBox.h"
+#include "CustomShape.h"
 
 namespace Chipmunk
 {
     Shape::Shape(cpShape* s, std::shared_ptr<Body> b) :
     _body(b),
-    _shape(s)
+    _shape(s),
+    _density(0.0f)
     { }
     
     Shape::~Shape()
@@ -20,6 +22,32 @@ namespace Chipmunk
         return _shape;
     }
     
+    std::shared_ptr<Shape> Shape::clone(std::shared_ptr<Body>) const
+    {
+        cpAssertHard(false, "clone not supported for this type.");
+        return nullptr;
+    }
+    
+    void Shape::copyProperties(Shape& shape) const
+    {
+        cpShape* s = shape._shape;
+        if (_density > 0.0f)
+        {
+            shape.setDensity(_density);
+        }
+        else if (cpShapeGetMass(_shape) > 0.0f)
+        {
+            cpShapeSetMass(s, cpShapeGetMass(_shape));
+        }
+        cpShapeSetSensor(s, cpShapeGetSensor(_shape));
+        cpShapeSetElasticity(s, cpShapeGetElasticity(_shape));
+        cpShapeSetFriction(s, cpShapeGetFriction(_shape));
+        cpShapeSetSurfaceVelocity(s, cpShapeGetSurfaceVelocity(_shape));
+        cpShapeSetUserData(s, cpShapeGetUserData(_shape));
+        cpShapeSetCollisionType(s, cpShapeGetCollisionType(_shape));
+        cpShapeSetFilter(s, cpShapeGetFilter(_shape));
+    }
+    
     void Shape::setBody(std::shared_ptr<Body> b)
     {
         cpShapeSetBody(_shape, b ? (*b) : (cpBody*)0);
@@ -31,10 +59,10 @@ namespace Chipmunk
         return cpShapePointQuery(_shape, p, nullptr) == cpTrue;
     }
     
-    bool Shape::segmentQuery(cpVect a, cpVect b, cpSegmentQueryInfo* const info)
+    bool Shape::segmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* const info)
     {
         cpSegmentQueryInfo i;
-        bool rtn = cpShapeSegmentQuery(_shape, a, b, 0, &i) == cpTrue;
+        bool rtn = cpShapeSegmentQuery(_shape, a, b, radius, &i) == cpTrue;
         if (info) {
             info->shape = i.shape;
             info->point = i.point;
@@ -44,6 +72,14 @@ namespace Chipmunk
         return rtn;
     }
     
+    cpContactPointSet Shape::shapesCollide(std::shared_ptr<Shape> shapeA, std::shared_ptr<Shape> shapeB)
+    {
+        // Chipmunk's collision table would index past its end with a custom shape's type.
+        cpAssertHard(!CustomShape::isCustom(*shapeA) && !CustomShape::isCustom(*shapeB),
+                     "cpShapesCollide() can't collide custom shapes.");
+        return cpShapesCollide(*shapeA, *shapeB);
+    }
+    
     BoundingBox Shape::cacheBoundingBox()
     {
         return BoundingBox(cpShapeCacheBB(_shape));
@@ -58,6 +94,55 @@ namespace Chipmunk
     {
         return BoundingBox(cpShapeGetBB(_shape));
     }
+    
+    void Shape::updateMass()
+    {
+        // Chipmunk's geometry setters keep the old mass, reapplying the density scales it with the new area.
+        if (_density > 0.0f && cpShapeGetBody(_shape))
+        {
+            cpShapeSetDensity(_shape, _density);
+        }
+    }
+    
+    static void postReindexShape(cpSpace* space, cpShape* shape, void*)
+    {
+        cpSpaceReindexShape(space, shape);
+    }
+    
+    void Shape::geometryChanged()
+    {
+        updateMass();
+        cpSpace* space = cpShapeGetSpace(_shape);
+        cpBody* body = cpShapeGetBody(_shape);
+        if (!body)
+        {
+            return;
+        }
+        if (!space)
+        {
+            cpShapeCacheBB(_shape);
+            return;
+        }
+        
+        if (cpBodyGetType(body) == CP_BODY_TYPE_STATIC)
+        {
+            if (cpSpaceIsLocked(space))
+            {
+                cpSpaceAddPostStepCallback(space, (cpPostStepFunc)postReindexShape, _shape, NULL);
+            }
+            else
+            {
+                cpSpaceReindexShape(space, _shape);
+            }
+            cpBodyActivateStatic(body, _shape);
+        }
+        else
+        {
+            // The dynamic index is refreshed from the cached bounding boxes every step.
+            cpShapeCacheBB(_shape);
+            cpBodyActivate(body);
+        }
+    }
 }
 
 
@@ -9,5 +9,13 @@ namespace Chipmunk
     Constraint(cpSimpleMotorNew(*bodyA, *bodyB, rate),
                bodyA, bodyB)
     { }
+    
+    std::shared_ptr<Constraint> SimpleMotor::clone(std::shared_ptr<Body> bodyA,
+                                                   std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<SimpleMotor>(bodyA, bodyB,
+                                                   cpSimpleMotorGetRate(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
 }
-
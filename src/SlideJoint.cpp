@@ -12,5 +12,16 @@ namespace Chipmunk
     Constraint(cpSlideJointNew(*bodyA, *bodyB, anchorA, anchorB, min, max),
                bodyA, bodyB)
     {}
+    
+    std::shared_ptr<Constraint> SlideJoint::clone(std::shared_ptr<Body> bodyA,
+                                                  std::shared_ptr<Body> bodyB) const
+    {
+        auto joint = std::make_shared<SlideJoint>(bodyA, bodyB,
+                                                  cpSlideJointGetAnchorA(_constraint),
+                                                  cpSlideJointGetAnchorB(_constraint),
+                                                  cpSlideJointGetMin(_constraint),
+                                                  cpSlideJointGetMax(_constraint));
+        copyProperties(*joint);
+        return joint;
+    }
 }
-
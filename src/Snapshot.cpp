@@ -0,0 +1,343 @@
+#include "Snapshot.h"
+#include "BitStream.h"
+#include "Space.h"
+#include "Body.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Chipmunk
+{
+    namespace
+    {
+        const int COUNT_GROUP_BITS = 8;
+        const int INDEX_GROUP_BITS = 4;
+        const int DELTA_GROUP_BITS = 4;
+        /// Bits a changed body takes at least, its index and its field mask.
+        const int MIN_CHANGED_BITS = INDEX_GROUP_BITS + 1 + SnapshotFrame::FIELD_COUNT;
+        /// Largest float below 2^31, 2147483647.0f rounds up to 2^31 which doesn't fit an int32_t.
+        const cpFloat MAX_STEPS = 2147483520.0f;
+
+        inline int32_t quantize(cpFloat value, cpFloat precision)
+        {
+            cpFloat steps = cpfclamp(value/precision, -MAX_STEPS, MAX_STEPS);
+            return static_cast<int32_t>(std::floor(steps + 0.5f));
+        }
+
+        inline uint32_t angleMask(int bits)
+        {
+            return bits >= 32 ? 0xffffffffu : (1u << bits) - 1;
+        }
+
+        SnapshotFrame::Body quantizeBody(const Body& body, const SnapshotSettings& settings)
+        {
+            cpFloat turn = 2.0f*CP_PI;
+            cpFloat angle = std::fmod(body.getAngle(), turn);
+            if (angle < 0.0f)
+            {
+                angle += turn;
+            }
+            cpVect p = body.getPosition();
+            cpVect v = body.getVelocity();
+
+            SnapshotFrame::Body quantized;
+            quantized.values[SnapshotFrame::POSITION_X] = quantize(p.x, settings.positionPrecision);
+            quantized.values[SnapshotFrame::POSITION_Y] = quantize(p.y, settings.positionPrecision);
+            // A full turn rounds to 2^angleBits, which doesn't fit 32 bits before the mask wraps it to 0.
+            uint64_t steps = static_cast<uint64_t>(std::floor(angle/turn*std::ldexp(1.0, settings.angleBits) + 0.5));
+            quantized.values[SnapshotFrame::ANGLE] = static_cast<int32_t>(static_cast<uint32_t>(steps & angleMask(settings.angleBits)));
+            quantized.values[SnapshotFrame::VELOCITY_X] = quantize(v.x, settings.velocityPrecision);
+            quantized.values[SnapshotFrame::VELOCITY_Y] = quantize(v.y, settings.velocityPrecision);
+            quantized.values[SnapshotFrame::ANGULAR_VELOCITY] = quantize(body.getAngularVelocity(), settings.angularVelocityPrecision);
+            return quantized;
+        }
+
+        inline bool operator==(const SnapshotFrame::Body& a, const SnapshotFrame::Body& b)
+        {
+            for (int i = 0; i < SnapshotFrame::FIELD_COUNT; i++)
+            {
+                if (a.values[i] != b.values[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        const SnapshotFrame::Body& bodyOrZero(const SnapshotFrame* frame, size_t index)
+        {
+            static const SnapshotFrame::Body zero = { { 0, 0, 0, 0, 0, 0 } };
+            return (frame && index < frame->bodies.size()) ? frame->bodies[index] : zero;
+        }
+
+        /// Difference between two field values, angles wrap around so the shortest way round is sent.
+        inline int32_t fieldDelta(int field, int32_t value, int32_t base, const SnapshotSettings& settings)
+        {
+            uint32_t delta = static_cast<uint32_t>(value) - static_cast<uint32_t>(base);
+            if (field == SnapshotFrame::ANGLE && settings.angleBits < 32)
+            {
+                delta &= angleMask(settings.angleBits);
+                if (delta >= (1u << (settings.angleBits - 1)))
+                {
+                    delta -= (1u << settings.angleBits);
+                }
+            }
+            return static_cast<int32_t>(delta);
+        }
+
+        inline int32_t applyDelta(int field, int32_t base, int32_t delta, const SnapshotSettings& settings)
+        {
+            uint32_t value = static_cast<uint32_t>(base) + static_cast<uint32_t>(delta);
+            if (field == SnapshotFrame::ANGLE)
+            {
+                value &= angleMask(settings.angleBits);
+            }
+            return static_cast<int32_t>(value);
+        }
+
+        inline SnapshotFrame* frameSlot(std::vector<SnapshotFrame>& history, uint32_t sequence)
+        {
+            return &history[sequence % history.size()];
+        }
+
+        inline const SnapshotFrame* findIn(const std::vector<SnapshotFrame>& history, uint32_t sequence)
+        {
+            if (sequence == SnapshotEncoder::NO_BASELINE)
+            {
+                return nullptr;
+            }
+            const SnapshotFrame& frame = history[sequence % history.size()];
+            return frame.sequence == sequence ? &frame : nullptr;
+        }
+
+        void resetHistory(std::vector<SnapshotFrame>& history, unsigned size)
+        {
+            history.resize(size > 0 ? size : 1);
+            for (auto& frame : history)
+            {
+                frame.sequence = SnapshotEncoder::NO_BASELINE;
+            }
+        }
+    }
+
+    const uint32_t SnapshotEncoder::NO_BASELINE;
+
+    SnapshotSettings::SnapshotSettings() :
+    positionPrecision(1.0f/64.0f),
+    velocityPrecision(1.0f/64.0f),
+    angularVelocityPrecision(1.0f/256.0f),
+    angleBits(12),
+    historySize(32),
+    maxBodies(65536)
+    { }
+
+    SnapshotEncoder::SnapshotEncoder(const Space& space, const SnapshotSettings& settings) :
+    _space(space),
+    _settings(settings),
+    _sequence(NO_BASELINE)
+    {
+        cpAssertHard(settings.angleBits >= 1 && settings.angleBits <= 32, "SnapshotSettings::angleBits must be 1 to 32.");
+        resetHistory(_history, settings.historySize);
+    }
+
+    const SnapshotFrame* SnapshotEncoder::findFrame(uint32_t sequence) const
+    {
+        return findIn(_history, sequence);
+    }
+
+    uint32_t SnapshotEncoder::capture()
+    {
+        const SnapshotFrame* previous = findFrame(_sequence);
+        if (++_sequence == NO_BASELINE)
+        {
+            _sequence = 0;
+        }
+
+        // Built aside so the previous frame stays readable even if both share a slot of the history.
+        SnapshotFrame frame;
+        frame.sequence = _sequence;
+        const auto& bodies = _space.getBodies();
+        cpAssertHard(bodies.size() <= _settings.maxBodies, "More bodies than SnapshotSettings::maxBodies.");
+        frame.bodies.resize(bodies.size());
+        for (size_t i = 0; i < bodies.size(); i++)
+        {
+            // Sleeping bodies can't have moved since they were last captured.
+            if (previous && i < previous->bodies.size() && cpBodyIsSleeping(*bodies[i]))
+            {
+                frame.bodies[i] = previous->bodies[i];
+            }
+            else
+            {
+                frame.bodies[i] = quantizeBody(*bodies[i], _settings);
+            }
+        }
+        std::swap(*frameSlot(_history, _sequence), frame);
+        return _sequence;
+    }
+
+    bool SnapshotEncoder::encode(uint32_t baseline, std::vector<uint8_t>& out) const
+    {
+        const SnapshotFrame* current = findFrame(_sequence);
+        cpAssertHard(current, "capture() must be called before encode().");
+        const SnapshotFrame* base = findFrame(baseline);
+        bool found = base || baseline == NO_BASELINE;
+
+        BitWriter writer(out);
+        writer.write(current->sequence, 32);
+        writer.write(base ? base->sequence : NO_BASELINE, 32);
+        writer.writeVarint(static_cast<uint32_t>(current->bodies.size()), COUNT_GROUP_BITS);
+
+        uint32_t changed = 0;
+        for (size_t i = 0; i < current->bodies.size(); i++)
+        {
+            if (!(current->bodies[i] == bodyOrZero(base, i)))
+            {
+                changed++;
+            }
+        }
+        writer.writeVarint(changed, COUNT_GROUP_BITS);
+
+        size_t next = 0;
+        for (size_t i = 0; i < current->bodies.size(); i++)
+        {
+            const SnapshotFrame::Body& body = current->bodies[i];
+            const SnapshotFrame::Body& from = bodyOrZero(base, i);
+            if (body == from)
+            {
+                continue;
+            }
+            writer.writeVarint(static_cast<uint32_t>(i - next), INDEX_GROUP_BITS);
+            next = i + 1;
+
+            uint32_t mask = 0;
+            for (int field = 0; field < SnapshotFrame::FIELD_COUNT; field++)
+            {
+                if (body.values[field] != from.values[field])
+                {
+                    mask |= 1u << field;
+                }
+            }
+            writer.write(mask, SnapshotFrame::FIELD_COUNT);
+            for (int field = 0; field < SnapshotFrame::FIELD_COUNT; field++)
+            {
+                if (mask & (1u << field))
+                {
+                    writer.writeSignedVarint(fieldDelta(field, body.values[field], from.values[field], _settings),
+                                             DELTA_GROUP_BITS);
+                }
+            }
+        }
+        return found;
+    }
+
+    SnapshotDecoder::SnapshotDecoder(Space& space, const SnapshotSettings& settings) :
+    _space(space),
+    _settings(settings),
+    _acknowledged(SnapshotEncoder::NO_BASELINE)
+    {
+        cpAssertHard(settings.angleBits >= 1 && settings.angleBits <= 32, "SnapshotSettings::angleBits must be 1 to 32.");
+        resetHistory(_history, settings.historySize);
+        _applied.sequence = SnapshotEncoder::NO_BASELINE;
+    }
+
+    const SnapshotFrame* SnapshotDecoder::findFrame(uint32_t sequence) const
+    {
+        return findIn(_history, sequence);
+    }
+
+    bool SnapshotDecoder::decode(const uint8_t* data, size_t size)
+    {
+        BitReader reader(data, size);
+        uint32_t sequence = reader.read(32);
+        uint32_t baseline = reader.read(32);
+        const SnapshotFrame* base = findFrame(baseline);
+        if (reader.hasOverflowed() || (!base && baseline != SnapshotEncoder::NO_BASELINE))
+        {
+            return false;
+        }
+
+        // Counts come from the network, check them before allocating anything for them.
+        uint32_t count = reader.readVarint(COUNT_GROUP_BITS);
+        uint32_t changed = reader.readVarint(COUNT_GROUP_BITS);
+        if (reader.hasOverflowed() || count > _settings.maxBodies || changed > count ||
+            changed > reader.getBitsLeft()/MIN_CHANGED_BITS)
+        {
+            return false;
+        }
+
+        SnapshotFrame frame;
+        frame.sequence = sequence;
+        frame.bodies.resize(count);
+        for (size_t i = 0; i < frame.bodies.size(); i++)
+        {
+            frame.bodies[i] = bodyOrZero(base, i);
+        }
+
+        size_t next = 0;
+        for (uint32_t i = 0; i < changed; i++)
+        {
+            size_t index = next + reader.readVarint(INDEX_GROUP_BITS);
+            if (index >= frame.bodies.size())
+            {
+                return false;
+            }
+            next = index + 1;
+
+            SnapshotFrame::Body& body = frame.bodies[index];
+            uint32_t mask = reader.read(SnapshotFrame::FIELD_COUNT);
+            for (int field = 0; field < SnapshotFrame::FIELD_COUNT; field++)
+            {
+                if (mask & (1u << field))
+                {
+                    body.values[field] = applyDelta(field, body.values[field],
+                                                    reader.readSignedVarint(DELTA_GROUP_BITS), _settings);
+                }
+            }
+        }
+        if (reader.hasOverflowed())
+        {
+            return false;
+        }
+
+        // Sequence numbers wrap around, so compare them by their signed distance.
+        bool newest = _acknowledged == SnapshotEncoder::NO_BASELINE ||
+                      static_cast<int32_t>(sequence - _acknowledged) > 0;
+        if (newest)
+        {
+            apply(frame);
+            _acknowledged = sequence;
+        }
+        std::swap(*frameSlot(_history, sequence), frame);
+        return true;
+    }
+
+    void SnapshotDecoder::apply(const SnapshotFrame& frame)
+    {
+        // Only bodies that differ from what was last applied are touched, this also
+        // restores bodies that changed in a snapshot newer than the one this was encoded against.
+        const auto& bodies = _space.getBodies();
+        size_t count = std::min(bodies.size(), frame.bodies.size());
+        cpFloat turn = 2.0f*CP_PI;
+        for (size_t i = 0; i < count; i++)
+        {
+            const SnapshotFrame::Body& body = frame.bodies[i];
+            if (i < _applied.bodies.size() && body == _applied.bodies[i])
+            {
+                continue;
+            }
+            const std::shared_ptr<Body>& target = bodies[i];
+            const int32_t* values = body.values;
+            target->setPosition(cpv(values[SnapshotFrame::POSITION_X]*_settings.positionPrecision,
+                                    values[SnapshotFrame::POSITION_Y]*_settings.positionPrecision));
+            target->setAngle(static_cast<uint32_t>(values[SnapshotFrame::ANGLE])*turn/std::ldexp(1.0, _settings.angleBits));
+            if (target->getBodyType() == CP_BODY_TYPE_STATIC)
+            {
+                _space.reindexShapesForBody(target);
+                continue;
+            }
+            target->setVelocity(cpv(values[SnapshotFrame::VELOCITY_X]*_settings.velocityPrecision,
+                                    values[SnapshotFrame::VELOCITY_Y]*_settings.velocityPrecision));
+            target->setAngularVelocity(values[SnapshotFrame::ANGULAR_VELOCITY]*_settings.angularVelocityPrecision);
+        }
+        _applied = frame;
+    }
+}
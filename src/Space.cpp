@@ -3,16 +3,87 @@
 #include "Body.h"
 #include "Constraint.h"
 #include "Arbiter.h"
+#include "ThreadPool.h"
+#include "StepPipeline.h"
+#include "CustomShape.h"
+extern "C" {
+#include <chipmunk_private.h>
+}
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace Chipmunk
 {
+    struct Space::Command
+    {
+        enum Type
+        {
+            ADD_SHAPE,
+            ADD_BODY,
+            ADD_CONSTRAINT,
+            REMOVE_SHAPE,
+            REMOVE_BODY,
+            REMOVE_CONSTRAINT,
+            IMPULSE,
+            FILTER,
+            FUNCTION,
+        };
+        
+        Type type;
+        std::shared_ptr<Shape> shape;
+        std::shared_ptr<Body> body;
+        std::shared_ptr<Constraint> constraint;
+        cpVect impulse;
+        cpVect point;
+        cpShapeFilter filter;
+        std::function<void(Space&)> func;
+        Command* next;
+        
+        explicit Command(Type type) :
+        type(type),
+        impulse(cpvzero),
+        point(cpvzero),
+        filter(CP_SHAPE_FILTER_ALL),
+        next(nullptr)
+        { }
+    };
+    
     Space::Space() :
     _space(cpSpaceNew()),
-    _staticBody(std::make_shared<Body>(cpSpaceGetStaticBody(_space)))
-    { }
+    _staticBody(std::make_shared<Body>(cpSpaceGetStaticBody(_space))),
+    _deterministic(false),
+    _stateHash(0),
+    _stepCount(0),
+    _commands(nullptr),
+    _maxSubsteps(1),
+    _qualityLevel(0),
+    _fullIterations(0),
+    _fullPersistence(0),
+    _stepUnitCost(0.0),
+    _parallelNarrowphase(false),
+    _lodEnabled(false),
+    _lodStats(),
+    _customShapes(0)
+    {
+        for (int i = 0; i < LOD_ASLEEP; i++)
+        {
+            _lodDistances[i] = INFINITY;
+        }
+    }
     
     Space::~Space()
     {
+        Command* command = _commands.exchange(nullptr);
+        while (command)
+        {
+            Command* next = command->next;
+            delete command;
+            command = next;
+        }
         for (auto& shape : _shapes)
         {
             cpSpaceRemoveShape(_space, *shape);
@@ -28,41 +99,849 @@ namespace Chipmunk
     
     void Space::step(cpFloat dt)
     {
-        cpSpaceStep(_space, dt);
+        ReadWriteLock::WriteGuard guard(_lock);
+        cpAssertHard(!cpSpaceIsLocked(_space), "The space can't be stepped during a step or from its callbacks.");
+        beginStep();
+        stepSpace(dt);
+        endStep();
+    }
+    
+    void Space::beginStep()
+    {
+        flushCommands();
+        applyLod();
+    }
+    
+    namespace
+    {
+        // Reduced rate bodies integrate once every RATE steps with the combined time step.
+        template <int RATE>
+        void lodVelocity(cpBody* body, cpVect gravity, cpFloat damping, cpFloat dt)
+        {
+            cpBodyUpdateVelocity(body, gravity, cpfpow(damping, RATE), dt*RATE);
+        }
+        
+        template <int RATE>
+        void lodPosition(cpBody* body, cpFloat dt)
+        {
+            // The bias velocity only corrects overlap from the last step, so it must not be scaled up.
+            body->v_bias = cpvmult(body->v_bias, 1.0f/RATE);
+            body->w_bias /= RATE;
+            cpBodyUpdatePosition(body, dt*RATE);
+        }
+        
+        void lodSkipVelocity(cpBody*, cpVect, cpFloat, cpFloat)
+        {
+        }
+        
+        void lodSkipPosition(cpBody* body, cpFloat)
+        {
+            body->v_bias = cpvzero;
+            body->w_bias = 0.0f;
+        }
+        
+        bool isLodManaged(cpBody* body)
+        {
+            cpBodyVelocityFunc velocity = body->velocity_func;
+            cpBodyPositionFunc position = body->position_func;
+            return ((velocity == cpBodyUpdateVelocity || velocity == lodVelocity<2> ||
+                     velocity == lodVelocity<4> || velocity == lodSkipVelocity) &&
+                    (position == cpBodyUpdatePosition || position == lodPosition<2> ||
+                     position == lodPosition<4> || position == lodSkipPosition));
+        }
+        
+        void setLodFuncs(cpBody* body, cpBodyVelocityFunc velocity, cpBodyPositionFunc position)
+        {
+            body->velocity_func = velocity;
+            body->position_func = position;
+        }
+    }
+    
+    void Space::setLodEnabled(bool enabled)
+    {
+        _lodEnabled = enabled;
+        if (!enabled)
+        {
+            resetLod();
+        }
+    }
+    
+    void Space::setLodDistances(cpFloat halfRate, cpFloat quarterRate, cpFloat sleep)
+    {
+        _lodDistances[LOD_FULL] = halfRate;
+        _lodDistances[LOD_HALF] = quarterRate;
+        _lodDistances[LOD_QUARTER] = sleep;
+    }
+    
+    void Space::resetLod()
+    {
+        for (auto& body : _bodies)
+        {
+            if (isLodManaged(*body))
+            {
+                setLodFuncs(*body, cpBodyUpdateVelocity, cpBodyUpdatePosition);
+            }
+        }
+        // Bodies that were only asleep because they were far away would otherwise stay frozen.
+        for (cpBody* body : _lodSlept)
+        {
+            if (cpBodyIsSleeping(body))
+            {
+                cpBodyActivate(body);
+            }
+        }
+        _lodSlept.clear();
+        _lodStats = LodStats();
+    }
+    
+    void Space::applyLod()
+    {
+        if (!_lodEnabled)
+        {
+            return;
+        }
+        _lodStats = LodStats();
+        _lodTiers.clear();
+        _lodGroups.clear();
+        _lodPhases.clear();
+        
+        // Pick a tier from the distance to the nearest observer.
+        auto tierAt = [this](cpVect p) {
+            cpFloat distSq = _lodObservers.empty() ? 0.0f : INFINITY;
+            for (auto& observer : _lodObservers)
+            {
+                distSq = cpfmin(distSq, cpvdistsq(p, observer));
+            }
+            int tier = LOD_FULL;
+            while (tier < LOD_ASLEEP && distSq >= _lodDistances[tier]*_lodDistances[tier])
+            {
+                tier++;
+            }
+            return tier;
+        };
+        for (auto& wrapper : _bodies)
+        {
+            cpBody* body = *wrapper;
+            if (cpBodyGetType(body) != CP_BODY_TYPE_DYNAMIC || !isLodManaged(body))
+            {
+                continue;
+            }
+            int tier = tierAt(body->p);
+            if (cpBodyIsSleeping(body))
+            {
+                if (tier == LOD_ASLEEP || _lodSlept.find(body) == _lodSlept.end())
+                {
+                    _lodStats.bodies[LOD_ASLEEP]++;
+                    continue;
+                }
+                // An observer came back within range of a body put to sleep for being far away.
+                cpBodyActivate(body);
+            }
+            _lodSlept.erase(body);
+            _lodTiers[body] = tier;
+            _lodGroups[body] = body;
+        }
+        
+        // Bodies that touched each other last step form groups stepped at the highest tier among them,
+        // so a contact passes a higher tier on through a whole stack or pile.
+        auto findGroup = [this](cpBody* body) {
+            while (_lodGroups[body] != body)
+            {
+                cpBody* parent = _lodGroups[body];
+                body = _lodGroups[body] = _lodGroups[parent];
+            }
+            return body;
+        };
+        cpArray* arbiters = _space->arbiters;
+        for (int i = 0; i < arbiters->num; i++)
+        {
+            cpArbiter* arb = (cpArbiter*)arbiters->arr[i];
+            if (_lodGroups.find(arb->body_a) == _lodGroups.end() || _lodGroups.find(arb->body_b) == _lodGroups.end())
+            {
+                continue;
+            }
+            cpBody* a = findGroup(arb->body_a);
+            cpBody* b = findGroup(arb->body_b);
+            if (a != b)
+            {
+                _lodGroups[b] = a;
+                _lodTiers[a] = std::min(_lodTiers[a], _lodTiers[b]);
+            }
+        }
+        
+        // Stagger reduced rate groups so each step integrates a similar share of them. Every member of a group
+        // takes the phase of its first body, so touching bodies always integrate on the same steps.
+        bool canSleep = cpSpaceGetSleepTimeThreshold(_space) != INFINITY;
+        for (size_t i = 0; i < _bodies.size(); i++)
+        {
+            cpBody* body = *_bodies[i];
+            if (_lodGroups.find(body) == _lodGroups.end())
+            {
+                continue;
+            }
+            cpBody* group = findGroup(body);
+            int tier = _lodTiers[group];
+            _lodStats.bodies[tier]++;
+            uint64_t phase = _lodPhases.emplace(group, _stepCount + i).first->second;
+            switch (tier)
+            {
+                case LOD_FULL:
+                    setLodFuncs(body, cpBodyUpdateVelocity, cpBodyUpdatePosition);
+                    break;
+                case LOD_HALF:
+                    if (phase % 2 == 0)
+                    {
+                        setLodFuncs(body, lodVelocity<2>, lodPosition<2>);
+                    }
+                    else
+                    {
+                        setLodFuncs(body, lodSkipVelocity, lodSkipPosition);
+                    }
+                    break;
+                case LOD_QUARTER:
+                    if (phase % 4 == 0)
+                    {
+                        setLodFuncs(body, lodVelocity<4>, lodPosition<4>);
+                    }
+                    else
+                    {
+                        setLodFuncs(body, lodSkipVelocity, lodSkipPosition);
+                    }
+                    break;
+                default:
+                    if (canSleep)
+                    {
+                        setLodFuncs(body, cpBodyUpdateVelocity, cpBodyUpdatePosition);
+                        cpBodySleep(body);
+                        _lodSlept.insert(body);
+                    }
+                    else
+                    {
+                        setLodFuncs(body, lodSkipVelocity, lodSkipPosition);
+                    }
+                    break;
+            }
+        }
+    }
+    
+    void Space::endStep()
+    {
+        _stepCount++;
+        if (_deterministic)
+        {
+            flushDeferredSeparates();
+            updateStateHash();
+        }
+    }
+    
+    void Space::stepSpace(cpFloat dt)
+    {
+        if (!_pipeline && (!_bullets.empty() || _customShapes > 0))
+        {
+            // Clamping bullets needs position updates separate from the rest of the step,
+            // and cpSpaceStep() can't collide custom shapes.
+            _pipeline.reset(new StepPipeline(_space));
+            _pipeline->setParallelNarrowphase(_parallelNarrowphase);
+        }
+        if (_pipeline)
+        {
+            sweepBullets(dt, *_pipeline);
+            _pipeline->step(dt);
+        }
+        else
+        {
+            cpSpaceStep(_space, dt);
+        }
+    }
+    
+    namespace
+    {
+        /// Radius of a circle around the body's position that contains @c shape.
+        cpFloat boundingRadius(cpShape* shape)
+        {
+            switch (shape->klass->type)
+            {
+                case CP_CIRCLE_SHAPE:
+                    return cpvlength(cpCircleShapeGetOffset(shape)) + cpCircleShapeGetRadius(shape);
+                case CP_SEGMENT_SHAPE:
+                    return (cpfmax(cpvlength(cpSegmentShapeGetA(shape)), cpvlength(cpSegmentShapeGetB(shape))) +
+                            cpSegmentShapeGetRadius(shape));
+                case CP_POLY_SHAPE:
+                {
+                    cpFloat radius = 0.0f;
+                    for (int i = 0; i < cpPolyShapeGetCount(shape); i++)
+                    {
+                        radius = cpfmax(radius, cpvlength(cpPolyShapeGetVert(shape, i)));
+                    }
+                    return radius + cpPolyShapeGetRadius(shape);
+                }
+                default:
+                {
+                    cpBB bb = cpShapeGetBB(shape);
+                    cpVect p = cpBodyGetPosition(cpShapeGetBody(shape));
+                    return cpvlength(cpv(cpfmax(p.x - bb.l, bb.r - p.x), cpfmax(p.y - bb.b, bb.t - p.y)));
+                }
+            }
+        }
+    }
+    
+    void Space::setBullet(std::shared_ptr<Body> body, bool bullet, cpFloat radius)
+    {
+        ReadWriteLock::WriteGuard guard(_lock);
+        auto it = std::find_if(_bullets.begin(), _bullets.end(),
+                               [&body](const Bullet& b) { return b.body == body; });
+        if (!bullet)
+        {
+            if (it != _bullets.end())
+            {
+                _bullets.erase(it);
+            }
+            return;
+        }
+        
+        if (it == _bullets.end())
+        {
+            Bullet added = { body, radius, { nullptr, cpvzero, cpvzero, 1.0f }, 1.0f };
+            _bullets.push_back(added);
+        }
+        else
+        {
+            it->radius = radius;
+        }
+    }
+    
+    bool Space::isBullet(const std::shared_ptr<Body>& body) const
+    {
+        return std::find_if(_bullets.begin(), _bullets.end(),
+                            [&body](const Bullet& b) { return b.body == body; }) != _bullets.end();
+    }
+    
+    void Space::sweepBullets(cpFloat dt, StepPipeline& pipeline)
+    {
+        _bulletImpacts.clear();
+        if (_bullets.empty())
+        {
+            return;
+        }
+        
+        Bullet* bullets = _bullets.data();
+        cpSpace* space = _space;
+        auto sweep = [this, bullets, space, dt](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                Bullet& bullet = bullets[i];
+                bullet.hit.shape = nullptr;
+                cpBody* body = *bullet.body;
+                if (cpBodyGetSpace(body) != space || cpBodyGetType(body) != CP_BODY_TYPE_DYNAMIC ||
+                    cpBodyIsSleeping(body) || !body->shapeList)
+                {
+                    continue;
+                }
+                
+                cpFloat radius = bullet.radius;
+                if (radius <= 0.0f)
+                {
+                    CP_BODY_FOREACH_SHAPE(body, shape)
+                    {
+                        radius = cpfmax(radius, boundingRadius(shape));
+                    }
+                }
+                
+                // Bodies that move less than their size in a step are caught by the normal collision detection.
+                cpVect motion = cpvmult(cpvadd(body->v, body->v_bias), dt);
+                cpFloat length = cpvlength(motion);
+                if (length <= radius*0.5f)
+                {
+                    continue;
+                }
+                
+                // Only hits the sweep moves into count, shapes already touching at the start are left to the contacts.
+                cpVect start = cpBodyGetPosition(body);
+                cpSegmentQueryInfo info;
+                if (indexSegmentQueryFirst(start, cpvadd(start, motion), radius, body->shapeList->filter, &info, body) &&
+                    cpvdot(info.normal, motion) < 0.0f &&
+                    info.alpha*length + radius*0.5f < length)
+                {
+                    bullet.hit = info;
+                    bullet.clamp = (info.alpha*length + radius*0.5f)/length;
+                }
+            }
+        };
+        if (_scheduler)
+        {
+            _scheduler->parallelFor(_bullets.size(), 16, sweep);
+            _scheduler->wait();
+        }
+        else
+        {
+            sweep(0, _bullets.size());
+        }
+        
+        for (auto& bullet : _bullets)
+        {
+            if (bullet.hit.shape)
+            {
+                pipeline.clampMotion(*bullet.body, bullet.clamp);
+                BulletImpact impact = { bullet.body, findShape(const_cast<cpShape*>(bullet.hit.shape)),
+                                        bullet.hit.point, bullet.hit.normal, bullet.hit.alpha };
+                _bulletImpacts.push_back(impact);
+            }
+        }
+    }
+    
+    void Space::setScheduler(std::shared_ptr<TaskScheduler> scheduler)
+    {
+        ReadWriteLock::WriteGuard guard(_lock);
+        _scheduler = scheduler;
+        _pipeline.reset();
+        if (_scheduler)
+        {
+            _pipeline.reset(new StepPipeline(_space));
+            _pipeline->setScheduler(_scheduler.get());
+            _pipeline->setParallelNarrowphase(_parallelNarrowphase);
+        }
+    }
+    
+    unsigned Space::getThreadCount() const
+    {
+        return _scheduler ? _scheduler->getThreadCount() : 1;
+    }
+    
+    void Space::setThreadCount(unsigned threads)
+    {
+        if (threads > 1)
+        {
+            setScheduler(std::make_shared<ThreadPool>(threads));
+        }
+        else
+        {
+            setScheduler(nullptr);
+        }
+    }
+    
+    void Space::setParallelNarrowphase(bool parallel)
+    {
+        ReadWriteLock::WriteGuard guard(_lock);
+        _parallelNarrowphase = parallel;
+        if (_pipeline)
+        {
+            _pipeline->setParallelNarrowphase(parallel);
+        }
+    }
+    
+    namespace
+    {
+        const int MAX_QUALITY_LEVEL = 4;
+        /// Rough cost of collision detection measured in solver iterations.
+        /// Only the ratio between levels matters, the absolute cost is measured.
+        const int COLLISION_COST_IN_ITERATIONS = 4;
+        
+        inline double workForQuality(const StepQuality& quality)
+        {
+            return quality.substeps*(quality.iterations + COLLISION_COST_IN_ITERATIONS);
+        }
+    }
+    
+    StepQuality Space::qualityForLevel(int level) const
+    {
+        StepQuality quality;
+        quality.level = level;
+        quality.iterations = std::max(1, _fullIterations >> level);
+        quality.substeps = std::max(1, _maxSubsteps >> level);
+        quality.collisionPersistence = _fullPersistence + level;
+        quality.microseconds = 0;
+        return quality;
+    }
+    
+    StepQuality Space::stepWithBudget(cpFloat dt, int64_t microseconds)
+    {
+        ReadWriteLock::WriteGuard guard(_lock);
+        cpAssertHard(!cpSpaceIsLocked(_space), "The space can't be stepped during a step or from its callbacks.");
+        // The space only holds reduced settings during the substeps below, so these are always the user's.
+        _fullIterations = cpSpaceGetIterations(_space);
+        _fullPersistence = cpSpaceGetCollisionPersistence(_space);
+        
+        // Pick the best level predicted to fit, but never improve by more than one level at a time.
+        int level = MAX_QUALITY_LEVEL;
+        if (_stepUnitCost > 0.0)
+        {
+            for (int l = std::max(0, _qualityLevel - 1); l < MAX_QUALITY_LEVEL; l++)
+            {
+                if (_stepUnitCost*workForQuality(qualityForLevel(l)) <= microseconds)
+                {
+                    level = l;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            level = _qualityLevel;
+        }
+        
+        StepQuality quality = qualityForLevel(level);
+        cpSpaceSetIterations(_space, quality.iterations);
+        cpSpaceSetCollisionPersistence(_space, quality.collisionPersistence);
+        _qualityLevel = level;
+        
+        auto start = std::chrono::steady_clock::now();
+        cpFloat substepDt = dt/quality.substeps;
+        for (int i = 0; i < quality.substeps; i++)
+        {
+            step(substepDt);
+        }
+        cpSpaceSetIterations(_space, _fullIterations);
+        cpSpaceSetCollisionPersistence(_space, _fullPersistence);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        quality.microseconds = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        
+        // Exponential moving average of the cost of one unit of work, so a single slow frame doesn't dominate.
+        double unitCost = quality.microseconds/workForQuality(quality);
+        _stepUnitCost = (_stepUnitCost > 0.0 ? _stepUnitCost*0.8 + unitCost*0.2 : unitCost);
+        return quality;
+    }
+    
+    namespace
+    {
+        const uint64_t HASH_PRIME = 1099511628211ull;
+        
+        inline uint64_t hashFloat(uint64_t hash, cpFloat value)
+        {
+            // Hash the bit pattern so that any difference, however small, changes the result.
+            uint64_t bits = 0;
+            std::memcpy(&bits, &value, sizeof(value));
+            return (hash ^ bits) * HASH_PRIME;
+        }
+        
+        inline bool sameFloat(cpFloat a, cpFloat b)
+        {
+            return std::memcmp(&a, &b, sizeof(cpFloat)) == 0;
+        }
+        
+        inline bool sameVect(cpVect a, cpVect b)
+        {
+            return sameFloat(a.x, b.x) && sameFloat(a.y, b.y);
+        }
+    }
+    
+    void Space::updateStateHash()
+    {
+        uint64_t hash = hashFloat(_stateHash ^ 14695981039346656037ull, static_cast<cpFloat>(_stepCount));
+        for (auto& body : _bodies)
+        {
+            const cpBody* b = *body;
+            hash = hashFloat(hash, b->p.x);
+            hash = hashFloat(hash, b->p.y);
+            hash = hashFloat(hash, b->v.x);
+            hash = hashFloat(hash, b->v.y);
+            hash = hashFloat(hash, b->a);
+            hash = hashFloat(hash, b->w);
+        }
+        _stateHash = hash;
+    }
+    
+    std::vector<BodyState> Space::captureState() const
+    {
+        std::vector<BodyState> states;
+        states.reserve(_bodies.size());
+        for (auto& body : _bodies)
+        {
+            const cpBody* b = *body;
+            BodyState state = { b->p, b->v, b->a, b->w };
+            states.push_back(state);
+        }
+        return states;
+    }
+    
+    DivergenceReport Space::findDivergence(const std::vector<BodyState>& expected) const
+    {
+        DivergenceReport report = { -1, nullptr, nullptr, BodyState(), BodyState() };
+        size_t count = std::min(expected.size(), _bodies.size());
+        for (size_t i = 0; i < count; i++)
+        {
+            const cpBody* b = *_bodies[i];
+            BodyState actual = { b->p, b->v, b->a, b->w };
+            const BodyState& e = expected[i];
+            const char* field = (!sameVect(e.position, actual.position) ? "position" :
+                                 !sameVect(e.velocity, actual.velocity) ? "velocity" :
+                                 !sameFloat(e.angle, actual.angle) ? "angle" :
+                                 !sameFloat(e.angularVelocity, actual.angularVelocity) ? "angularVelocity" :
+                                 nullptr);
+            if (field)
+            {
+                report.index = static_cast<int>(i);
+                report.body = _bodies[i];
+                report.field = field;
+                report.expected = e;
+                report.actual = actual;
+                return report;
+            }
+        }
+        if (expected.size() != _bodies.size())
+        {
+            report.index = static_cast<int>(count);
+            report.body = count < _bodies.size() ? _bodies[count] : nullptr;
+            report.field = "count";
+        }
+        return report;
+    }
+    
+    void Space::flushDeferredSeparates()
+    {
+        // Chipmunk finds separated pairs by walking a hash set keyed on shape addresses, which differs between runs.
+        // Shape hash ids are handed out in insertion order, so sorting by them gives the same order everywhere.
+        std::sort(_deferredSeparates.begin(), _deferredSeparates.end(),
+                  [](const DeferredSeparate& l, const DeferredSeparate& r)
+                  {
+                      return l.a != r.a ? l.a < r.a : l.b < r.b;
+                  });
+        // Callbacks may trigger more separations (by removing shapes), so swap the list out first.
+        std::vector<DeferredSeparate> separates;
+        separates.swap(_deferredSeparates);
+        for (auto& separate : separates)
+        {
+            separate.data->separate(separate.arbiter.get(), *this);
+        }
     }
     
     void Space::add(std::shared_ptr<Shape> shape)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceAddShape(_space, *shape);
         _shapes.push_back(shape);
+        _shapeLookup[*shape] = shape;
+        if (CustomShape::isCustom(*shape))
+        {
+            _customShapes++;
+        }
+    }
+    
+    void Space::add(const std::vector<std::shared_ptr<Shape>>& shapes)
+    {
+        ReadWriteLock::WriteGuard guard(_lock);
+        _shapes.reserve(_shapes.size() + shapes.size());
+        for (auto& shape : shapes)
+        {
+            cpSpaceAddShape(_space, *shape);
+            _shapes.push_back(shape);
+            _shapeLookup[*shape] = shape;
+            if (CustomShape::isCustom(*shape))
+            {
+                _customShapes++;
+            }
+        }
     }
     
     void Space::add(std::shared_ptr<Body> body)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceAddBody(_space, *body);
         _bodies.push_back(body);
     }
  
     void Space::add(std::shared_ptr<Constraint> constraint)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceAddConstraint(_space, *constraint);
         _constraints.push_back(constraint);
     }
     
+    void Space::pushCommand(Command* command)
+    {
+        // Lock free push onto a stack, flushCommands() takes the whole stack at once and reverses it.
+        Command* head = _commands.load(std::memory_order_relaxed);
+        do
+        {
+            command->next = head;
+        }
+        while (!_commands.compare_exchange_weak(head, command,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    }
+    
+    void Space::enqueueAdd(std::shared_ptr<Shape> shape)
+    {
+        Command* command = new Command(Command::ADD_SHAPE);
+        command->shape = shape;
+        pushCommand(command);
+    }
+    
+    void Space::enqueueAdd(std::shared_ptr<Body> body)
+    {
+        Command* command = new Command(Command::ADD_BODY);
+        command->body = body;
+        pushCommand(command);
+    }
+    
+    void Space::enqueueAdd(std::shared_ptr<Constraint> constraint)
+    {
+        Command* command = new Command(Command::ADD_CONSTRAINT);
+        command->constraint = constraint;
+        pushCommand(command);
+    }
+    
+    void Space::enqueueRemove(std::shared_ptr<Shape> shape)
+    {
+        Command* command = new Command(Command::REMOVE_SHAPE);
+        command->shape = shape;
+        pushCommand(command);
+    }
+    
+    void Space::enqueueRemove(std::shared_ptr<Body> body)
+    {
+        Command* command = new Command(Command::REMOVE_BODY);
+        command->body = body;
+        pushCommand(command);
+    }
+    
+    void Space::enqueueRemove(std::shared_ptr<Constraint> constraint)
+    {
+        Command* command = new Command(Command::REMOVE_CONSTRAINT);
+        command->constraint = constraint;
+        pushCommand(command);
+    }
+    
+    void Space::enqueueImpulse(std::shared_ptr<Body> body, cpVect impulse, cpVect point)
+    {
+        Command* command = new Command(Command::IMPULSE);
+        command->body = body;
+        command->impulse = impulse;
+        command->point = point;
+        pushCommand(command);
+    }
+    
+    void Space::enqueueFilter(std::shared_ptr<Shape> shape, cpShapeFilter filter)
+    {
+        Command* command = new Command(Command::FILTER);
+        command->shape = shape;
+        command->filter = filter;
+        pushCommand(command);
+    }
+    
+    void Space::enqueue(std::function<void(Space&)> func)
+    {
+        Command* command = new Command(Command::FUNCTION);
+        command->func = func;
+        pushCommand(command);
+    }
+    
+    void Space::flushCommands()
+    {
+        if (_commands.load(std::memory_order_relaxed) == nullptr)
+        {
+            return;
+        }
+        if (cpSpaceIsLocked(_space))
+        {
+            helperPostCommands(this);
+            return;
+        }
+        ReadWriteLock::WriteGuard guard(_lock);
+        
+        // Take everything queued so far and reverse it into the order it was queued in.
+        Command* stack = _commands.exchange(nullptr, std::memory_order_acquire);
+        Command* queue = nullptr;
+        while (stack)
+        {
+            Command* next = stack->next;
+            stack->next = queue;
+            queue = stack;
+            stack = next;
+        }
+        
+        while (queue)
+        {
+            Command* command = queue;
+            queue = command->next;
+            switch (command->type)
+            {
+                case Command::ADD_SHAPE:
+                    add(command->shape);
+                    break;
+                case Command::ADD_BODY:
+                    add(command->body);
+                    break;
+                case Command::ADD_CONSTRAINT:
+                    add(command->constraint);
+                    break;
+                case Command::REMOVE_SHAPE:
+                    if (cpSpaceContainsShape(_space, *command->shape))
+                    {
+                        remove(command->shape);
+                    }
+                    break;
+                case Command::REMOVE_BODY:
+                    if (cpSpaceContainsBody(_space, *command->body))
+                    {
+                        remove(command->body);
+                    }
+                    break;
+                case Command::REMOVE_CONSTRAINT:
+                    if (cpSpaceContainsConstraint(_space, *command->constraint))
+                    {
+                        remove(command->constraint);
+                    }
+                    break;
+                case Command::IMPULSE:
+                    cpBodyApplyImpulseAtWorldPoint(*command->body, command->impulse, command->point);
+                    break;
+                case Command::FILTER:
+                    cpShapeSetFilter(*command->shape, command->filter);
+                    break;
+                case Command::FUNCTION:
+                    command->func(*this);
+                    break;
+            }
+            delete command;
+        }
+    }
+    
     void Space::remove(std::shared_ptr<Shape> shape)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceRemoveShape(_space, *shape);
         _shapes.erase(find(_shapes.begin(), _shapes.end(), shape));
+        _shapeLookup.erase(*shape);
+        if (CustomShape::isCustom(*shape))
+        {
+            _customShapes--;
+        }
+    }
+    
+    void Space::remove(const std::vector<std::shared_ptr<Shape>>& shapes)
+    {
+        ReadWriteLock::WriteGuard guard(_lock);
+        std::unordered_set<cpShape*> removed;
+        for (auto& shape : shapes)
+        {
+            cpSpaceRemoveShape(_space, *shape);
+            _shapeLookup.erase(*shape);
+            removed.insert(*shape);
+            if (CustomShape::isCustom(*shape))
+            {
+                _customShapes--;
+            }
+        }
+        _shapes.erase(std::remove_if(_shapes.begin(), _shapes.end(),
+                                     [&removed](const std::shared_ptr<Shape>& s) { return removed.count(*s) > 0; }),
+                      _shapes.end());
     }
     
     void Space::remove(std::shared_ptr<Body> body)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceRemoveBody(_space, *body);
         _bodies.erase(find(_bodies.begin(), _bodies.end(), body));
+        _lodSlept.erase(*body);
+        _bullets.erase(std::remove_if(_bullets.begin(), _bullets.end(),
+                                      [&body](const Bullet& b) { return b.body == body; }),
+                       _bullets.end());
     }
 
     void Space::remove(std::shared_ptr<Constraint> constraint)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceRemoveConstraint(_space, *constraint);
         _constraints.erase(find(_constraints.begin(), _constraints.end(), constraint));
     }
@@ -72,13 +951,19 @@ namespace Chipmunk
         if (!shape) {
             return std::shared_ptr<Shape>((Shape*)0);
         }
-        auto it = find_if(_shapes.begin(), _shapes.end(),
-                          [&shape](const std::shared_ptr<Shape>& s)
-                          {
-                              return *s == shape;
-                          });
-        assert(it != _shapes.end());
-        return *it;
+        auto it = _shapeLookup.find(shape);
+        assert(it != _shapeLookup.end());
+        return it->second;
+    }
+    
+    Shape* Space::lookupShape(cpShape* shape) const
+    {
+        if (!shape) {
+            return nullptr;
+        }
+        auto it = _shapeLookup.find(shape);
+        assert(it != _shapeLookup.end());
+        return it->second.get();
     }
     
     std::shared_ptr<Body> Space::findBody(cpBody* body) const
@@ -120,32 +1005,142 @@ namespace Chipmunk
         d->func(d->self->findShape(shape), alpha, normal);
     }
     
+    namespace
+    {
+        // Index callbacks mirroring the ones in cpSpaceQuery.c.
+        // Going to the indexes directly skips cpSpaceLock(), which writes to the space and would race between threads.
+        struct SegmentQueryContext
+        {
+            cpVect start, end;
+            cpFloat radius;
+            cpShapeFilter filter;
+            cpSpaceSegmentQueryFunc func;
+            void* data;
+            /// Shapes of this body are skipped.
+            cpBody* ignore;
+        };
+        
+        cpFloat segmentQueryEach(SegmentQueryContext* context, cpShape* shape, void*)
+        {
+            cpSegmentQueryInfo info;
+            if (!cpShapeFilterReject(shape->filter, context->filter) &&
+                cpShapeSegmentQuery(shape, context->start, context->end, context->radius, &info))
+            {
+                context->func(shape, info.point, info.normal, info.alpha, context->data);
+            }
+            return 1.0f;
+        }
+        
+        cpFloat segmentQueryFirstEach(SegmentQueryContext* context, cpShape* shape, cpSegmentQueryInfo* out)
+        {
+            cpSegmentQueryInfo info;
+            if (!cpShapeFilterReject(shape->filter, context->filter) &&
+                !shape->sensor && shape->body != context->ignore &&
+                cpShapeSegmentQuery(shape, context->start, context->end, context->radius, &info) &&
+                info.alpha < out->alpha)
+            {
+                *out = info;
+            }
+            return out->alpha;
+        }
+        
+        struct PointQueryContext
+        {
+            cpVect point;
+            cpShapeFilter filter;
+        };
+        
+        cpCollisionID pointQueryNearestEach(PointQueryContext* context, cpShape* shape, cpCollisionID id, cpPointQueryInfo* out)
+        {
+            if (!cpShapeFilterReject(shape->filter, context->filter) && !shape->sensor)
+            {
+                cpPointQueryInfo info;
+                cpShapePointQuery(shape, context->point, &info);
+                if (info.distance < out->distance)
+                {
+                    *out = info;
+                }
+            }
+            return id;
+        }
+        
+        inline cpShapeFilter filterFor(LayerMask layers, cpGroup group)
+        {
+            cpShapeFilter filter {
+                static_cast<cpGroup>(group),
+                static_cast<cpBitmask>(layers),
+                static_cast<cpBitmask>(layers)
+            };
+            return filter;
+        }
+        
+        void collectSegmentHit(cpShape* shape, cpVect point, cpVect normal, cpFloat alpha, void* data)
+        {
+            auto hits = reinterpret_cast<std::vector<std::pair<cpShape*, cpSegmentQueryInfo>>*>(data);
+            cpSegmentQueryInfo info = { shape, point, normal, alpha };
+            hits->push_back(std::make_pair(shape, info));
+        }
+    }
+    
+    void Space::indexSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpShapeFilter filter,
+                                  cpSpaceSegmentQueryFunc func, void* data) const
+    {
+        SegmentQueryContext context = { a, b, radius, filter, func, data, nullptr };
+        cpSpatialIndexSegmentQuery(_space->staticShapes, &context, a, b, 1.0f,
+                                   (cpSpatialIndexSegmentQueryFunc)segmentQueryEach, nullptr);
+        cpSpatialIndexSegmentQuery(_space->dynamicShapes, &context, a, b, 1.0f,
+                                   (cpSpatialIndexSegmentQueryFunc)segmentQueryEach, nullptr);
+    }
+    
+    cpShape* Space::indexSegmentQueryFirst(cpVect a, cpVect b, cpFloat radius, cpShapeFilter filter,
+                                           cpSegmentQueryInfo* out, cpBody* ignore) const
+    {
+        cpSegmentQueryInfo info = { nullptr, b, cpvzero, 1.0f };
+        *out = info;
+        SegmentQueryContext context = { a, b, radius, filter, nullptr, nullptr, ignore };
+        cpSpatialIndexSegmentQuery(_space->staticShapes, &context, a, b, 1.0f,
+                                   (cpSpatialIndexSegmentQueryFunc)segmentQueryFirstEach, out);
+        cpSpatialIndexSegmentQuery(_space->dynamicShapes, &context, a, b, out->alpha,
+                                   (cpSpatialIndexSegmentQueryFunc)segmentQueryFirstEach, out);
+        return const_cast<cpShape*>(out->shape);
+    }
+    
+    cpShape* Space::indexPointQueryNearest(cpVect p, cpFloat maxDistance, cpShapeFilter filter,
+                                           cpPointQueryInfo* out) const
+    {
+        cpPointQueryInfo info = { nullptr, cpvzero, maxDistance, cpvzero };
+        *out = info;
+        PointQueryContext context = { p, filter };
+        cpBB bb = cpBBNewForCircle(p, cpfmax(maxDistance, 0.0f));
+        cpSpatialIndexQuery(_space->dynamicShapes, &context, bb,
+                            (cpSpatialIndexQueryFunc)pointQueryNearestEach, out);
+        cpSpatialIndexQuery(_space->staticShapes, &context, bb,
+                            (cpSpatialIndexQueryFunc)pointQueryNearestEach, out);
+        return const_cast<cpShape*>(out->shape);
+    }
+    
     void Space::segmentQuery(cpVect a,
                              cpVect b,
+                             cpFloat radius,
                              LayerMask layers,
                              cpGroup group,
                              SegmentQueryFunc func) const
     {
+        ReadWriteLock::ReadGuard guard(_lock);
         SegmentQueryData data = { this, func };
-        cpShapeFilter filter{static_cast<cpGroup>(group),
-            static_cast<cpBitmask>(layers),
-            static_cast<cpBitmask>(layers)};
-        cpSpaceSegmentQuery(_space, a, b, 0, filter, segmentQueryFunc, &data);
+        indexSegmentQuery(a, b, radius, filterFor(layers, group), segmentQueryFunc, &data);
     }
     
     std::shared_ptr<Shape> Space::segmentQueryFirst(cpVect a,
                                                     cpVect b,
+                                                    cpFloat radius,
                                                     LayerMask layers,
                                                     cpGroup group,
                                                     cpSegmentQueryInfo* const info) const
     {
+        ReadWriteLock::ReadGuard guard(_lock);
         cpSegmentQueryInfo i;
-        cpShapeFilter filter {
-            static_cast<cpGroup>(group),
-            static_cast<cpBitmask>(layers),
-            static_cast<cpBitmask>(layers)
-        };
-        auto rtn = cpSpaceSegmentQueryFirst(_space, a, b, 0, filter, &i);
+        auto rtn = indexSegmentQueryFirst(a, b, radius, filterFor(layers, group), &i);
         if (info)
         {
             info->shape = i.shape;
@@ -156,15 +1151,424 @@ namespace Chipmunk
         return findShape(rtn);
     }
     
+    const std::vector<SegmentQueryHit>& Space::segmentQueryAll(cpVect a,
+                                                               cpVect b,
+                                                               cpFloat radius,
+                                                               LayerMask layers,
+                                                               cpGroup group) const
+    {
+        // Scratch buffers owned by the calling thread, they keep their capacity between queries.
+        static thread_local std::vector<std::pair<cpShape*, cpSegmentQueryInfo>> found;
+        static thread_local std::vector<SegmentQueryHit> hits;
+        found.clear();
+        hits.clear();
+        
+        ReadWriteLock::ReadGuard guard(_lock);
+        indexSegmentQuery(a, b, radius, filterFor(layers, group), collectSegmentHit, &found);
+        std::sort(found.begin(), found.end(),
+                  [](const std::pair<cpShape*, cpSegmentQueryInfo>& l, const std::pair<cpShape*, cpSegmentQueryInfo>& r)
+                  {
+                      return l.second.alpha < r.second.alpha;
+                  });
+        for (auto& f : found)
+        {
+            SegmentQueryHit hit = { lookupShape(f.first), f.second.point, f.second.normal, f.second.alpha };
+            hits.push_back(hit);
+        }
+        return hits;
+    }
+    
+    void Space::segmentQueryFirst(const cpVect* starts,
+                                  const cpVect* ends,
+                                  size_t count,
+                                  cpFloat radius,
+                                  LayerMask layers,
+                                  cpGroup group,
+                                  SegmentQueryHit* hits) const
+    {
+        ReadWriteLock::ReadGuard guard(_lock);
+        cpShapeFilter filter = filterFor(layers, group);
+        for (size_t i = 0; i < count; i++)
+        {
+            cpSegmentQueryInfo info;
+            cpShape* shape = indexSegmentQueryFirst(starts[i], ends[i], radius, filter, &info);
+            SegmentQueryHit hit = { lookupShape(shape), info.point, info.normal, info.alpha };
+            hits[i] = hit;
+        }
+    }
+    
+    namespace
+    {
+        /// Points of a convex shape in world coordinates. The shape is their convex hull grown by @c radius.
+        struct ConvexHull
+        {
+            const cpVect* verts;
+            /// Distance between consecutive points in cpVects.
+            int stride;
+            int count;
+            cpFloat radius;
+            cpVect offset;
+            
+            cpVect support(cpVect dir) const
+            {
+                const cpVect* best = verts;
+                cpFloat bestDot = cpvdot(*best, dir);
+                for (int i = 1; i < count; i++)
+                {
+                    const cpVect* v = verts + i*stride;
+                    cpFloat d = cpvdot(*v, dir);
+                    if (d > bestDot)
+                    {
+                        best = v;
+                        bestDot = d;
+                    }
+                }
+                return cpvadd(*best, offset);
+            }
+        };
+        
+        /// The hull of a shape in the space, using its cached world coordinates.
+        bool hullFor(const cpShape* shape, ConvexHull* hull)
+        {
+            hull->offset = cpvzero;
+            switch (shape->klass->type)
+            {
+                case CP_CIRCLE_SHAPE:
+                {
+                    auto circle = reinterpret_cast<const cpCircleShape*>(shape);
+                    hull->verts = &circle->tc;
+                    hull->stride = 1;
+                    hull->count = 1;
+                    hull->radius = circle->r;
+                    return true;
+                }
+                case CP_SEGMENT_SHAPE:
+                {
+                    auto segment = reinterpret_cast<const cpSegmentShape*>(shape);
+                    hull->verts = &segment->ta;
+                    hull->stride = static_cast<int>(&segment->tb - &segment->ta);
+                    hull->count = 2;
+                    hull->radius = segment->r;
+                    return true;
+                }
+                case CP_POLY_SHAPE:
+                {
+                    auto poly = reinterpret_cast<const cpPolyShape*>(shape);
+                    hull->verts = &poly->planes[0].v0;
+                    hull->stride = static_cast<int>(sizeof(cpSplittingPlane)/sizeof(cpVect));
+                    hull->count = poly->count;
+                    hull->radius = poly->r;
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
+        
+        struct SimplexVertex
+        {
+            cpVect a;
+            cpVect b;
+            /// a - b, a point of the Minkowski difference.
+            cpVect p;
+        };
+        
+        SimplexVertex simplexVertex(const ConvexHull& a, const ConvexHull& b, cpVect dir)
+        {
+            SimplexVertex v;
+            v.a = a.support(dir);
+            v.b = b.support(cpvneg(dir));
+            v.p = cpvsub(v.a, v.b);
+            return v;
+        }
+        
+        /// Reduce the segment @c x, @c y to the part closest to the origin, returns the number of vertices kept.
+        int closestOnSegment(const SimplexVertex& x, const SimplexVertex& y, SimplexVertex* out, cpFloat* weights)
+        {
+            cpVect e = cpvsub(y.p, x.p);
+            cpFloat lengthSq = cpvlengthsq(e);
+            cpFloat t = lengthSq > 0.0f ? -cpvdot(x.p, e)/lengthSq : 0.0f;
+            if (t <= 0.0f)
+            {
+                out[0] = x;
+                weights[0] = 1.0f;
+                return 1;
+            }
+            if (t >= 1.0f)
+            {
+                out[0] = y;
+                weights[0] = 1.0f;
+                return 1;
+            }
+            out[0] = x;
+            out[1] = y;
+            weights[0] = 1.0f - t;
+            weights[1] = t;
+            return 2;
+        }
+        
+        cpVect weightedSum(const SimplexVertex* simplex, const cpFloat* weights, int count, cpVect SimplexVertex::*field)
+        {
+            cpVect sum = cpvzero;
+            for (int i = 0; i < count; i++)
+            {
+                sum = cpvadd(sum, cpvmult(simplex[i].*field, weights[i]));
+            }
+            return sum;
+        }
+        
+        /// GJK distance between the hulls' points, ignoring their radii.
+        /// Returns false if they overlap, otherwise the closest points of both are written to @c pa and @c pb.
+        bool closestPoints(const ConvexHull& a, const ConvexHull& b, cpVect* pa, cpVect* pb)
+        {
+            SimplexVertex simplex[3];
+            cpFloat weights[3] = { 1.0f, 0.0f, 0.0f };
+            int count = 1;
+            simplex[0] = simplexVertex(a, b, cpv(1.0f, 0.0f));
+            
+            for (int iteration = 0; iteration < 32; iteration++)
+            {
+                if (count == 2)
+                {
+                    SimplexVertex x = simplex[0], y = simplex[1];
+                    count = closestOnSegment(x, y, simplex, weights);
+                }
+                else if (count == 3)
+                {
+                    cpFloat c0 = cpvcross(cpvsub(simplex[1].p, simplex[0].p), cpvneg(simplex[0].p));
+                    cpFloat c1 = cpvcross(cpvsub(simplex[2].p, simplex[1].p), cpvneg(simplex[1].p));
+                    cpFloat c2 = cpvcross(cpvsub(simplex[0].p, simplex[2].p), cpvneg(simplex[2].p));
+                    if ((c0 >= 0.0f && c1 >= 0.0f && c2 >= 0.0f) || (c0 <= 0.0f && c1 <= 0.0f && c2 <= 0.0f))
+                    {
+                        return false;
+                    }
+                    // Outside the triangle, keep whichever edge is closest.
+                    SimplexVertex best[2];
+                    cpFloat bestWeights[2];
+                    int bestCount = 0;
+                    cpFloat bestDistance = INFINITY;
+                    for (int i = 0; i < 3; i++)
+                    {
+                        SimplexVertex edge[2];
+                        cpFloat edgeWeights[2];
+                        int edgeCount = closestOnSegment(simplex[i], simplex[(i + 1)%3], edge, edgeWeights);
+                        cpFloat distance = cpvlengthsq(weightedSum(edge, edgeWeights, edgeCount, &SimplexVertex::p));
+                        if (distance < bestDistance)
+                        {
+                            std::copy(edge, edge + edgeCount, best);
+                            std::copy(edgeWeights, edgeWeights + edgeCount, bestWeights);
+                            bestCount = edgeCount;
+                            bestDistance = distance;
+                        }
+                    }
+                    std::copy(best, best + bestCount, simplex);
+                    std::copy(bestWeights, bestWeights + bestCount, weights);
+                    count = bestCount;
+                }
+                
+                cpVect v = weightedSum(simplex, weights, count, &SimplexVertex::p);
+                cpFloat vv = cpvlengthsq(v);
+                if (vv <= 1e-12f)
+                {
+                    return false;
+                }
+                
+                SimplexVertex w = simplexVertex(a, b, cpvneg(v));
+                bool repeated = false;
+                for (int i = 0; i < count; i++)
+                {
+                    repeated = repeated || cpveql(w.p, simplex[i].p);
+                }
+                // Stop once the new support point gets no closer to the origin.
+                if (repeated || vv - cpvdot(w.p, v) <= 1e-6f*vv)
+                {
+                    break;
+                }
+                simplex[count++] = w;
+            }
+            
+            *pa = weightedSum(simplex, weights, count, &SimplexVertex::a);
+            *pb = weightedSum(simplex, weights, count, &SimplexVertex::b);
+            return true;
+        }
+        
+        struct ShapeCastContext
+        {
+            ConvexHull hull;
+            cpVect start;
+            cpVect motion;
+            cpBB bounds;
+            cpFloat tolerance;
+            cpShapeFilter filter;
+            cpBody* ignore;
+            cpSegmentQueryInfo* out;
+        };
+        
+        /// Conservative advancement: move the cast hull by the distance between the hulls divided by the speed it
+        /// closes that distance at, which can never pass the time of impact of two convex shapes.
+        /// The cast stops once the shapes are within the tolerance of each other.
+        void castAgainst(ShapeCastContext* context, cpShape* shape, const ConvexHull& target)
+        {
+            ConvexHull& hull = context->hull;
+            cpSegmentQueryInfo* out = context->out;
+            cpFloat radius = hull.radius + target.radius;
+            cpFloat t = 0.0f;
+            // Closest point on the target's surface and its normal from the last iteration.
+            cpVect point = cpvzero;
+            cpVect normal = cpvzero;
+            for (int iteration = 0; iteration < 32; iteration++)
+            {
+                hull.offset = cpvadd(context->start, cpvmult(context->motion, t));
+                cpVect pa, pb;
+                if (!closestPoints(hull, target, &pa, &pb))
+                {
+                    // Only reachable at the start or through rounding, advancing always stops short of contact.
+                    if (t > 0.0f)
+                    {
+                        cpSegmentQueryInfo info = { shape, point, normal, t };
+                        *out = info;
+                    }
+                    return;
+                }
+                cpVect delta = cpvsub(pa, pb);
+                cpFloat length = cpvlength(delta);
+                cpVect n = cpvmult(delta, 1.0f/length);
+                cpFloat distance = length - radius;
+                if (t == 0.0f && distance < 0.0f)
+                {
+                    // Already overlapping at the start.
+                    return;
+                }
+                point = cpvadd(pb, cpvmult(n, target.radius));
+                normal = n;
+                if (distance <= context->tolerance || iteration == 31)
+                {
+                    cpSegmentQueryInfo info = { shape, point, normal, t };
+                    *out = info;
+                    return;
+                }
+                
+                cpFloat speed = -cpvdot(context->motion, n);
+                if (speed <= 0.0f)
+                {
+                    return;
+                }
+                // Aim just short of contact so the hulls never overlap.
+                t += (distance - context->tolerance*0.5f)/speed;
+                if (t >= out->alpha)
+                {
+                    return;
+                }
+            }
+        }
+        
+        cpCollisionID shapeCastEach(ShapeCastContext* context, cpShape* shape, cpCollisionID id, void*)
+        {
+            if (cpShapeFilterReject(shape->filter, context->filter) || shape->sensor || shape->body == context->ignore)
+            {
+                return id;
+            }
+            
+            ConvexHull target;
+            if (hullFor(shape, &target))
+            {
+                castAgainst(context, shape, target);
+            }
+            else if (CustomShape::isCustom(shape))
+            {
+                // Cast against each part under the swept box, the best hit reports the custom shape itself.
+                static thread_local std::vector<CustomShape::Part> parts;
+                parts.clear();
+                CustomShape::fromShape(shape)->queryParts(context->bounds, parts);
+                for (auto& part : parts)
+                {
+                    ConvexHull partHull = { part.verts, 1, part.count, part.radius, cpvzero };
+                    castAgainst(context, shape, partHull);
+                }
+            }
+            return id;
+        }
+    }
+    
+    cpShape* Space::indexShapeCast(cpShape* shape, cpVect start, cpVect end, cpShapeFilter filter,
+                                   cpSegmentQueryInfo* out) const
+    {
+        cpSegmentQueryInfo info = { nullptr, cpvzero, cpvzero, 1.0f };
+        *out = info;
+        cpBody* body = shape->body;
+        cpVect rot = body ? cpBodyGetRotation(body) : cpv(1.0f, 0.0f);
+        
+        // The cast shape's points relative to its body's position. Circles go through the same cast as the other
+        // shapes rather than a thick segment query, which would report shapes overlapping them at the start.
+        static thread_local std::vector<cpVect> verts;
+        verts.clear();
+        ConvexHull hull;
+        switch (shape->klass->type)
+        {
+            case CP_CIRCLE_SHAPE:
+                verts.push_back(cpvrotate(cpCircleShapeGetOffset(shape), rot));
+                hull.radius = cpCircleShapeGetRadius(shape);
+                break;
+            case CP_SEGMENT_SHAPE:
+                verts.push_back(cpvrotate(cpSegmentShapeGetA(shape), rot));
+                verts.push_back(cpvrotate(cpSegmentShapeGetB(shape), rot));
+                hull.radius = cpSegmentShapeGetRadius(shape);
+                break;
+            case CP_POLY_SHAPE:
+                for (int i = 0; i < cpPolyShapeGetCount(shape); i++)
+                {
+                    verts.push_back(cpvrotate(cpPolyShapeGetVert(shape, i), rot));
+                }
+                hull.radius = cpPolyShapeGetRadius(shape);
+                break;
+            default:
+                cpAssertHard(false, "Only circle, segment and polygon shapes can be cast.");
+        }
+        hull.verts = verts.data();
+        hull.stride = 1;
+        hull.count = static_cast<int>(verts.size());
+        hull.offset = cpvzero;
+        
+        // Cull with the box swept by the shape.
+        cpBB bb = cpBBNew(INFINITY, INFINITY, -INFINITY, -INFINITY);
+        for (auto& v : verts)
+        {
+            bb = cpBBExpand(cpBBExpand(bb, cpvadd(start, v)), cpvadd(end, v));
+        }
+        bb = cpBBNew(bb.l - hull.radius, bb.b - hull.radius, bb.r + hull.radius, bb.t + hull.radius);
+        
+        cpVect motion = cpvsub(end, start);
+        ShapeCastContext context = { hull, start, motion, bb, cpfmax(cpvlength(motion)*1e-4f, 1e-6f), filter, body, out };
+        cpSpatialIndexQuery(_space->staticShapes, &context, bb, (cpSpatialIndexQueryFunc)shapeCastEach, nullptr);
+        cpSpatialIndexQuery(_space->dynamicShapes, &context, bb, (cpSpatialIndexQueryFunc)shapeCastEach, nullptr);
+        return const_cast<cpShape*>(out->shape);
+    }
+    
+    std::shared_ptr<Shape> Space::shapeCast(std::shared_ptr<Shape> shape,
+                                            cpVect start,
+                                            cpVect end,
+                                            LayerMask layers,
+                                            cpGroup group,
+                                            cpSegmentQueryInfo* const info) const
+    {
+        ReadWriteLock::ReadGuard guard(_lock);
+        cpSegmentQueryInfo i;
+        auto rtn = indexShapeCast(*shape, start, end, filterFor(layers, group), &i);
+        if (info)
+        {
+            *info = i;
+        }
+        return findShape(rtn);
+    }
+    
     std::shared_ptr<Shape> Space::pointQueryNearest(cpVect p,
                                                   LayerMask layers,
-                                                  cpGroup group) const
+                                                  cpGroup group,
+                                                  cpFloat maxDistance) const
     {
-        cpShapeFilter filter{static_cast<cpGroup>(group),
-            static_cast<cpBitmask>(layers),
-            static_cast<cpBitmask>(layers)};
+        ReadWriteLock::ReadGuard guard(_lock);
         cpPointQueryInfo i;
-        return findShape(cpSpacePointQueryNearest(_space, p, 100, filter, &i));
+        return findShape(indexPointQueryNearest(p, maxDistance, filterFor(layers, group), &i));
     }
     
     cpBool Space::helperBegin(cpArbiter* arb, cpSpace* s, void* d)
@@ -188,6 +1592,22 @@ namespace Chipmunk
     void Space::helperSeparate(cpArbiter* arb, cpSpace* s, void* d)
     {
         CallbackData& data = *reinterpret_cast<CallbackData*>(d);
+        if (data.self._deterministic && cpSpaceIsLocked(s))
+        {
+            // The arbiter is returned to the space's pool, and earlier callbacks may remove and free either shape
+            // before this one runs. The copy keeps the shapes alive and has no contacts, which are gone by then.
+            DeferredSeparate separate;
+            separate.arbiter = std::make_shared<cpArbiter>(*arb);
+            separate.arbiter->count = 0;
+            separate.arbiter->contacts = nullptr;
+            separate.shapeA = data.self.findShape(const_cast<cpShape*>(arb->a));
+            separate.shapeB = data.self.findShape(const_cast<cpShape*>(arb->b));
+            separate.data = &data;
+            separate.a = arb->a->hashid;
+            separate.b = arb->b->hashid;
+            data.self._deferredSeparates.push_back(separate);
+            return;
+        }
         return data.separate(arb, data.self);
     }
     
@@ -198,6 +1618,7 @@ namespace Chipmunk
                                     std::function<void(Arbiter, Space&)> postSolve,
                                     std::function<void(Arbiter, Space&)> separate)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         auto data = new CallbackData(begin, preSolve, postSolve, separate, *this);
         callbackDatas[std::make_pair(a, b)] = std::unique_ptr<CallbackData>(data);
         cpCollisionHandler* handler = cpSpaceAddCollisionHandler(_space, a, b);
@@ -208,18 +1629,149 @@ namespace Chipmunk
         handler->userData = data;
     }
 
+    std::unique_ptr<Space> Space::clone() const
+    {
+        ReadWriteLock::ReadGuard guard(_lock);
+        std::unique_ptr<Space> copy(new Space());
+        cpSpace* space = copy->_space;
+        cpSpaceSetIterations(space, cpSpaceGetIterations(_space));
+        cpSpaceSetGravity(space, cpSpaceGetGravity(_space));
+        cpSpaceSetDamping(space, cpSpaceGetDamping(_space));
+        cpSpaceSetIdleSpeedThreshold(space, cpSpaceGetIdleSpeedThreshold(_space));
+        cpSpaceSetSleepTimeThreshold(space, cpSpaceGetSleepTimeThreshold(_space));
+        cpSpaceSetCollisionSlop(space, cpSpaceGetCollisionSlop(_space));
+        cpSpaceSetCollisionBias(space, cpSpaceGetCollisionBias(_space));
+        cpSpaceSetCollisionPersistence(space, cpSpaceGetCollisionPersistence(_space));
+        cpSpaceSetUserData(space, cpSpaceGetUserData(_space));
+        copy->_deterministic = _deterministic;
+        copy->_parallelNarrowphase = _parallelNarrowphase;
+        copy->_lodEnabled = _lodEnabled;
+        copy->_lodObservers = _lodObservers;
+        std::copy(_lodDistances, _lodDistances + LOD_ASLEEP, copy->_lodDistances);
+        // Copies share the scheduler, loops from spaces stepped at the same time run serially.
+        copy->setScheduler(_scheduler);
+        
+        cpBody* staticBody = cpSpaceGetStaticBody(_space);
+        cpBodySetPosition(*copy->_staticBody, cpBodyGetPosition(staticBody));
+        cpBodySetAngle(*copy->_staticBody, cpBodyGetAngle(staticBody));
+        
+        // Maps bodies of this space to their copies, shapes and constraints are rewired through it.
+        std::unordered_map<cpBody*, std::shared_ptr<Body>> bodies(_bodies.size() + 1);
+        bodies[staticBody] = copy->_staticBody;
+        auto bodyFor = [&bodies](const std::shared_ptr<Body>& body) -> std::shared_ptr<Body>
+        {
+            if (!body)
+            {
+                return body;
+            }
+            auto it = bodies.find(*body);
+            if (it != bodies.end())
+            {
+                return it->second;
+            }
+            // Bodies that were never added to the space (such as user created static bodies) are copied on demand.
+            auto clone = body->clone();
+            bodies[*body] = clone;
+            return clone;
+        };
+        
+        copy->_bodies.reserve(_bodies.size());
+        for (auto& body : _bodies)
+        {
+            auto clone = body->clone();
+            bodies[*body] = clone;
+            copy->add(clone);
+        }
+        for (auto& bullet : _bullets)
+        {
+            copy->setBullet(bodyFor(bullet.body), true, bullet.radius);
+        }
+        
+        copy->_shapes.reserve(_shapes.size());
+        for (auto& shape : _shapes)
+        {
+            copy->add(shape->clone(bodyFor(shape->getBody())));
+        }
+        
+        copy->_constraints.reserve(_constraints.size());
+        for (auto& constraint : _constraints)
+        {
+            copy->add(constraint->clone(bodyFor(constraint->getBodyA()),
+                                        bodyFor(constraint->getBodyB())));
+        }
+        
+        for (auto& it : callbackDatas)
+        {
+            const CallbackData& data = *it.second;
+            copy->addCollisionHandler(it.first.first, it.first.second,
+                                      data.begin, data.preSolve, data.postSolve, data.separate);
+        }
+        return copy;
+    }
+    
     void Space::reindexShapesForBody(std::shared_ptr<Body> body)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceReindexShapesForBody(_space, *body);
     }
     
     void Space::reindexShape(std::shared_ptr<Shape> shape)
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         cpSpaceReindexShape(_space, *shape);
     }
 
+    void Space::updateMorphedShapes(const std::vector<std::shared_ptr<Shape>>& shapes)
+    {
+        ReadWriteLock::WriteGuard guard(_lock);
+        cpAssertHard(!cpSpaceIsLocked(_space), "Morphed shapes can't be updated while the space is locked.");
+        int staticCount = 0;
+        for (auto& shape : shapes)
+        {
+            shape->updateMass();
+            cpShape* s = *shape;
+            if (cpShapeGetSpace(s) == _space && cpBodyGetType(cpShapeGetBody(s)) == CP_BODY_TYPE_STATIC)
+            {
+                staticCount++;
+            }
+            else if (cpShapeGetBody(s))
+            {
+                // The dynamic index is refreshed from the cached bounding boxes every step.
+                cpShapeCacheBB(s);
+            }
+        }
+        
+        bool rebuildStatic = staticCount > cpSpatialIndexCount(_space->staticShapes)/4;
+        if (rebuildStatic)
+        {
+            cpSpaceReindexStatic(_space);
+        }
+        for (auto& shape : shapes)
+        {
+            cpShape* s = *shape;
+            if (cpShapeGetSpace(s) != _space)
+            {
+                continue;
+            }
+            cpBody* body = cpShapeGetBody(s);
+            if (cpBodyGetType(body) == CP_BODY_TYPE_STATIC)
+            {
+                if (!rebuildStatic)
+                {
+                    cpSpaceReindexShape(_space, s);
+                }
+                cpBodyActivateStatic(body, s);
+            }
+            else
+            {
+                cpBodyActivate(body);
+            }
+        }
+    }
+    
     void Space::clearSpace()
     {
+        ReadWriteLock::WriteGuard guard(_lock);
         // Must remove these BEFORE freeing the bodies or you will access dangling pointers.
         cpSpaceEachShape(_space, (cpSpaceShapeIteratorFunc)helperPostShapeFree, _space);
         cpSpaceEachConstraint(_space, (cpSpaceConstraintIteratorFunc)helperPostConstraintFree, _space);
@@ -288,4 +1840,15 @@ namespace Chipmunk
     {
         cpSpaceAddPostStepCallback(space, (cpPostStepFunc)helperBodyAddWrap, body, NULL);
     }
+    
+    void Space::helperCommandsWrap(cpSpace*, Space *self, void*)
+    {
+        self->flushCommands();
+    }
+    
+    void Space::helperPostCommands(Space *self)
+    {
+        // Keyed on the space wrapper so any number of flush requests in a step only flush once.
+        cpSpaceAddPostStepCallback(self->_space, (cpPostStepFunc)helperCommandsWrap, self, NULL);
+    }
 }
\ No newline at end of file
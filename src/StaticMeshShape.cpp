@@ -0,0 +1,333 @@
+#include "StaticMeshShape.h"
+#include "Body.h"
+#include <algorithm>
+
+namespace Chipmunk
+{
+    namespace
+    {
+        const size_t LEAF_SIZE = 4;
+        const int MAX_DEPTH = 64;
+
+        cpBB expand(cpBB bb, cpFloat radius)
+        {
+            return cpBBNew(bb.l - radius, bb.b - radius, bb.r + radius, bb.t + radius);
+        }
+
+        /// Fraction along a to b where the segment enters @c bb, INFINITY when it misses.
+        /// cpBBSegmentQuery() alone accepts axis aligned segments running beside the box.
+        cpFloat enterFraction(cpBB bb, cpVect a, cpVect b)
+        {
+            cpBB segment = cpBBNew(cpfmin(a.x, b.x), cpfmin(a.y, b.y), cpfmax(a.x, b.x), cpfmax(a.y, b.y));
+            return cpBBIntersects(bb, segment) ? cpBBSegmentQuery(bb, a, b) : INFINITY;
+        }
+
+        cpFloat distanceTo(cpBB bb, cpVect p)
+        {
+            return cpvdist(p, cpBBClampVect(bb, p));
+        }
+    }
+
+    StaticMeshShape::StaticMeshShape(std::shared_ptr<Body> body,
+                                     const std::vector<cpVect>& vertices,
+                                     const std::vector<uint32_t>& indices,
+                                     int vertsPerPrimitive,
+                                     cpFloat radius) :
+    CustomShape(body),
+    _vertsPerPrimitive(vertsPerPrimitive),
+    _radius(radius)
+    {
+        cpAssertHard(vertsPerPrimitive == 2 || vertsPerPrimitive == 3, "Mesh primitives are edges or triangles.");
+        cpAssertHard(indices.size() % vertsPerPrimitive == 0, "Index count is not a multiple of the primitive size.");
+        size_t count = indices.size()/vertsPerPrimitive;
+
+        // Edges sharing a vertex with exactly one other edge are neighbours.
+        std::vector<int> incidentCount(vertices.size(), 0);
+        std::vector<size_t> incident(vertices.size()*2, 0);
+        if (vertsPerPrimitive == 2)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                for (int end = 0; end < 2; end++)
+                {
+                    uint32_t v = indices[i*2 + end];
+                    if (incidentCount[v] < 2)
+                    {
+                        incident[v*2 + incidentCount[v]] = i;
+                    }
+                    incidentCount[v]++;
+                }
+            }
+        }
+        auto neighbour = [&](size_t edge, uint32_t v, cpVect self) -> cpVect {
+            if (incidentCount[v] != 2)
+            {
+                return self;
+            }
+            size_t other = (incident[v*2] == edge) ? incident[v*2 + 1] : incident[v*2];
+            uint32_t a = indices[other*2];
+            return vertices[a == v ? indices[other*2 + 1] : a];
+        };
+
+        std::vector<Primitive> primitives;
+        primitives.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            Primitive primitive;
+            for (int v = 0; v < vertsPerPrimitive; v++)
+            {
+                cpAssertHard(indices[i*vertsPerPrimitive + v] < vertices.size(), "Mesh index out of range.");
+                primitive.verts[v] = vertices[indices[i*vertsPerPrimitive + v]];
+            }
+            cpVect ab = cpvsub(primitive.verts[1], primitive.verts[0]);
+            if (vertsPerPrimitive == 2)
+            {
+                if (cpvlengthsq(ab) == 0.0f)
+                {
+                    continue;
+                }
+                primitive.verts[2] = primitive.verts[1];
+                primitive.prev = neighbour(i, indices[i*2], primitive.verts[0]);
+                primitive.next = neighbour(i, indices[i*2 + 1], primitive.verts[1]);
+                primitive.hasNeighbors = true;
+            }
+            else
+            {
+                cpVect ac = cpvsub(primitive.verts[2], primitive.verts[0]);
+                cpFloat area = cpvcross(ab, ac);
+                if (cpfabs(area) <= 1e-9f*(cpvlengthsq(ab) + cpvlengthsq(ac)))
+                {
+                    continue;
+                }
+                if (area < 0.0f)
+                {
+                    std::swap(primitive.verts[1], primitive.verts[2]);
+                }
+                primitive.prev = cpvzero;
+                primitive.next = cpvzero;
+                primitive.hasNeighbors = false;
+            }
+            cpBB bb = cpBBExpand(cpBBNewForExtents(primitive.verts[0], 0.0f, 0.0f), primitive.verts[1]);
+            primitive.bb = expand(cpBBExpand(bb, primitive.verts[2]), radius);
+            primitives.push_back(primitive);
+        }
+
+        if (!primitives.empty())
+        {
+            _primitives.reserve(primitives.size());
+            _nodes.reserve(2*primitives.size()/LEAF_SIZE + 1);
+            build(primitives, 0, primitives.size());
+        }
+    }
+
+    std::shared_ptr<Shape> StaticMeshShape::clone(std::shared_ptr<Body> body) const
+    {
+        auto shape = std::make_shared<StaticMeshShape>(body, std::vector<cpVect>(), std::vector<uint32_t>(),
+                                                       _vertsPerPrimitive, _radius);
+        shape->_primitives = _primitives;
+        shape->_nodes = _nodes;
+        copyProperties(*shape);
+        return shape;
+    }
+
+    void StaticMeshShape::build(std::vector<Primitive>& primitives, size_t begin, size_t end)
+    {
+        size_t index = _nodes.size();
+        _nodes.push_back(Node());
+        cpBB bb = primitives[begin].bb;
+        cpBB centers = cpBBNewForExtents(cpBBCenter(bb), 0.0f, 0.0f);
+        for (size_t i = begin + 1; i < end; i++)
+        {
+            bb = cpBBMerge(bb, primitives[i].bb);
+            centers = cpBBExpand(centers, cpBBCenter(primitives[i].bb));
+        }
+        _nodes[index].bb = bb;
+
+        if (end - begin <= LEAF_SIZE)
+        {
+            _nodes[index].offset = static_cast<uint32_t>(_primitives.size());
+            _nodes[index].count = static_cast<uint32_t>(end - begin);
+            _primitives.insert(_primitives.end(), primitives.begin() + begin, primitives.begin() + end);
+            return;
+        }
+
+        // Split at the median center along the longer axis.
+        bool alongX = (centers.r - centers.l) >= (centers.t - centers.b);
+        size_t middle = begin + (end - begin)/2;
+        std::nth_element(primitives.begin() + begin, primitives.begin() + middle, primitives.begin() + end,
+                         [alongX](const Primitive& l, const Primitive& r) {
+                             cpVect lc = cpBBCenter(l.bb);
+                             cpVect rc = cpBBCenter(r.bb);
+                             return alongX ? lc.x < rc.x : lc.y < rc.y;
+                         });
+        build(primitives, begin, middle);
+        _nodes[index].offset = static_cast<uint32_t>(_nodes.size());
+        _nodes[index].count = 0;
+        build(primitives, middle, end);
+    }
+
+    void StaticMeshShape::primitivePart(size_t index, Part& part) const
+    {
+        const Primitive& primitive = _primitives[index];
+        part.id = static_cast<cpHashValue>(index);
+        part.count = _vertsPerPrimitive;
+        for (int v = 0; v < _vertsPerPrimitive; v++)
+        {
+            part.verts[v] = primitive.verts[v];
+        }
+        part.radius = _radius;
+        part.hasNeighbors = primitive.hasNeighbors;
+        part.prev = primitive.prev;
+        part.next = primitive.next;
+    }
+
+    cpBB StaticMeshShape::localBounds() const
+    {
+        return _nodes.empty() ? cpBBNew(0.0f, 0.0f, 0.0f, 0.0f) : _nodes[0].bb;
+    }
+
+    void StaticMeshShape::localParts(cpBB bb, std::vector<Part>& parts) const
+    {
+        if (_nodes.empty())
+        {
+            return;
+        }
+        uint32_t stack[MAX_DEPTH];
+        int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const Node& node = _nodes[stack[--depth]];
+            if (!cpBBIntersects(node.bb, bb))
+            {
+                continue;
+            }
+            if (node.count == 0)
+            {
+                stack[depth++] = node.offset;
+                stack[depth++] = static_cast<uint32_t>(&node - _nodes.data()) + 1;
+                continue;
+            }
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+            {
+                if (cpBBIntersects(_primitives[i].bb, bb))
+                {
+                    parts.push_back(Part());
+                    primitivePart(i, parts.back());
+                }
+            }
+        }
+    }
+
+    bool StaticMeshShape::localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const
+    {
+        if (_nodes.empty())
+        {
+            return false;
+        }
+
+        // Visit the nearer child first and skip nodes entered beyond the best hit.
+        struct Entry
+        {
+            uint32_t node;
+            cpFloat enter;
+        };
+        Entry stack[MAX_DEPTH];
+        int depth = 0;
+        stack[depth++] = { 0, enterFraction(expand(_nodes[0].bb, radius), a, b) };
+
+        bool found = false;
+        Part part;
+        while (depth > 0)
+        {
+            Entry entry = stack[--depth];
+            if (entry.enter == INFINITY || entry.enter > info->alpha)
+            {
+                continue;
+            }
+            const Node& node = _nodes[entry.node];
+            if (node.count == 0)
+            {
+                Entry first = { entry.node + 1, enterFraction(expand(_nodes[entry.node + 1].bb, radius), a, b) };
+                Entry second = { node.offset, enterFraction(expand(_nodes[node.offset].bb, radius), a, b) };
+                if (first.enter < second.enter)
+                {
+                    std::swap(first, second);
+                }
+                stack[depth++] = first;
+                stack[depth++] = second;
+                continue;
+            }
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+            {
+                if (enterFraction(expand(_primitives[i].bb, radius), a, b) > info->alpha)
+                {
+                    continue;
+                }
+                primitivePart(i, part);
+                cpSegmentQueryInfo hit;
+                if (partSegmentQuery(part, a, b, radius, &hit) && hit.alpha < info->alpha)
+                {
+                    *info = hit;
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    void StaticMeshShape::localPointQuery(cpVect p, cpPointQueryInfo* info) const
+    {
+        if (_nodes.empty())
+        {
+            return;
+        }
+
+        // Visit the nearer child first and skip nodes further away than the nearest primitive found.
+        struct Entry
+        {
+            uint32_t node;
+            cpFloat distance;
+        };
+        Entry stack[MAX_DEPTH];
+        int depth = 0;
+        stack[depth++] = { 0, distanceTo(_nodes[0].bb, p) };
+
+        Part part;
+        while (depth > 0)
+        {
+            Entry entry = stack[--depth];
+            if (entry.distance > info->distance)
+            {
+                continue;
+            }
+            const Node& node = _nodes[entry.node];
+            if (node.count == 0)
+            {
+                Entry first = { entry.node + 1, distanceTo(_nodes[entry.node + 1].bb, p) };
+                Entry second = { node.offset, distanceTo(_nodes[node.offset].bb, p) };
+                if (first.distance < second.distance)
+                {
+                    std::swap(first, second);
+                }
+                stack[depth++] = first;
+                stack[depth++] = second;
+                continue;
+            }
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+            {
+                if (distanceTo(_primitives[i].bb, p) > info->distance)
+                {
+                    continue;
+                }
+                cpPointQueryInfo nearest;
+                primitivePart(i, part);
+                partPointQuery(part, p, &nearest);
+                if (nearest.distance < info->distance)
+                {
+                    *info = nearest;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,701 @@
+#include "StepPipeline.h"
+#include "TaskScheduler.h"
+#include "CustomShape.h"
+extern "C" {
+#include <chipmunk_private.h>
+}
+#include <algorithm>
+#include <cstring>
+
+namespace Chipmunk
+{
+    StepPipeline::StepPipeline(cpSpace* space) :
+    _space(space),
+    _scheduler(nullptr),
+    _dt(0.0f),
+    _prevDt(0.0f),
+    _parallelNarrowphase(false)
+    { }
+
+    void StepPipeline::step(cpFloat dt)
+    {
+        if (!begin(dt))
+        {
+            return;
+        }
+        integratePositions();
+        broadphase();
+        narrowphase();
+        processComponents();
+        preStep();
+        integrateVelocities();
+        applyCachedImpulses();
+        solve(_space->iterations);
+        finish();
+    }
+
+    void StepPipeline::parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& func)
+    {
+        if (_scheduler)
+        {
+            _scheduler->parallelFor(count, grain, func);
+            _scheduler->wait();
+        }
+        else if (count > 0)
+        {
+            func(0, count);
+        }
+    }
+
+    size_t StepPipeline::islandGrain() const
+    {
+        // Several chunks per thread so a few large islands don't leave the other threads idle.
+        size_t threads = _scheduler ? _scheduler->getThreadCount() : 1;
+        return std::max<size_t>(1, _islands.size()/(threads*8));
+    }
+
+    bool StepPipeline::begin(cpFloat dt)
+    {
+        // don't step if the timestep is 0!
+        if (dt == 0.0f)
+        {
+            // Clamps queued for a step that doesn't run would be applied to the next one.
+            _clamps.clear();
+            return false;
+        }
+
+        _space->stamp++;
+        _prevDt = _space->curr_dt;
+        _space->curr_dt = dt;
+        _dt = dt;
+
+        // Reset and empty the arbiter lists.
+        cpArray* arbiters = _space->arbiters;
+        for (int i = 0; i < arbiters->num; i++)
+        {
+            cpArbiter* arb = (cpArbiter*)arbiters->arr[i];
+            arb->state = CP_ARBITER_STATE_NORMAL;
+
+            // If both bodies are awake, unthread the arbiter from the contact graph.
+            if (!cpBodyIsSleeping(arb->body_a) && !cpBodyIsSleeping(arb->body_b))
+            {
+                cpArbiterUnthread(arb);
+            }
+        }
+        arbiters->num = 0;
+
+        cpSpaceLock(_space);
+        return true;
+    }
+
+    namespace
+    {
+        void skipPosition(cpBody*, cpFloat)
+        {
+        }
+    }
+
+    void StepPipeline::clampMotion(cpBody* body, cpFloat alpha)
+    {
+        MotionClamp clamp = { body, alpha, nullptr };
+        _clamps.push_back(clamp);
+    }
+
+    void StepPipeline::integratePositions()
+    {
+        cpArray* bodies = _space->dynamicBodies;
+        cpFloat dt = _dt;
+
+        // Clamped bodies move first and are skipped by the parallel loop.
+        for (auto& clamp : _clamps)
+        {
+            clamp.func = clamp.body->position_func;
+            clamp.func(clamp.body, dt*clamp.alpha);
+            clamp.body->position_func = skipPosition;
+        }
+        parallelFor(bodies->num, 256, [bodies, dt](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            cpBody* body = (cpBody*)bodies->arr[i];
+                            body->position_func(body, dt);
+                        }
+                    });
+        for (auto& clamp : _clamps)
+        {
+            clamp.body->position_func = clamp.func;
+        }
+        _clamps.clear();
+    }
+
+    void StepPipeline::broadphase()
+    {
+        cpSpacePushFreshContactBuffer(_space);
+        if (!_parallelNarrowphase)
+        {
+            cpSpatialIndexEach(_space->dynamicShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
+            cpSpatialIndexReindexQuery(_space->dynamicShapes, (cpSpatialIndexQueryFunc)collideShapes, this);
+            return;
+        }
+
+        _shapes.clear();
+        cpSpatialIndexEach(_space->dynamicShapes, (cpSpatialIndexIteratorFunc)collectShape, &_shapes);
+        cpShape** shapes = _shapes.data();
+        parallelFor(_shapes.size(), 256, [shapes](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            cpShapeUpdateFunc(shapes[i], NULL);
+                        }
+                    });
+
+        _pairs.clear();
+        cpSpatialIndexReindexQuery(_space->dynamicShapes, (cpSpatialIndexQueryFunc)collectPair, this);
+    }
+
+    void StepPipeline::narrowphase()
+    {
+        if (_parallelNarrowphase)
+        {
+            NarrowphasePair* pairs = _pairs.data();
+            parallelFor(_pairs.size(), 64, [pairs](size_t begin, size_t end)
+                        {
+                            for (size_t i = begin; i < end; i++)
+                            {
+                                NarrowphasePair& pair = pairs[i];
+                                if (queryReject(pair.a, pair.b))
+                                {
+                                    pair.info.count = 0;
+                                }
+                                else if (CustomShape::isCustom(pair.a) || CustomShape::isCustom(pair.b))
+                                {
+                                    pair.info = CustomShape::collide(pair.a, pair.b, pair.id, pair.contacts);
+                                }
+                                else
+                                {
+                                    pair.info = cpCollide(pair.a, pair.b, pair.id, pair.contacts);
+                                }
+                            }
+                        });
+
+            // Arbiters and callbacks are handled in broadphase order, the same order cpSpaceStep() uses.
+            for (auto& pair : _pairs)
+            {
+                if (pair.info.count > 0)
+                {
+                    applyPair(pair);
+                }
+            }
+        }
+    }
+
+    cpCollisionID StepPipeline::collectPair(cpShape* a, cpShape* b, cpCollisionID id, StepPipeline* self)
+    {
+        NarrowphasePair pair;
+        pair.a = a;
+        pair.b = b;
+        pair.id = id;
+        self->_pairs.push_back(pair);
+        return id;
+    }
+
+    cpCollisionID StepPipeline::collideShapes(cpShape* a, cpShape* b, cpCollisionID id, StepPipeline* self)
+    {
+        if (!CustomShape::isCustom(a) && !CustomShape::isCustom(b))
+        {
+            return cpSpaceCollideShapes(a, b, id, self->_space);
+        }
+        if (!queryReject(a, b))
+        {
+            NarrowphasePair pair;
+            pair.a = a;
+            pair.b = b;
+            pair.id = id;
+            pair.info = CustomShape::collide(a, b, id, pair.contacts);
+            if (pair.info.count > 0)
+            {
+                self->applyPair(pair);
+            }
+        }
+        return id;
+    }
+
+    void StepPipeline::collectShape(cpShape* shape, std::vector<cpShape*>* shapes)
+    {
+        shapes->push_back(shape);
+    }
+
+    bool StepPipeline::queryReject(const cpShape* a, const cpShape* b)
+    {
+        if (
+            // BBoxes must overlap
+            !cpBBIntersects(a->bb, b->bb)
+            // Don't collide shapes attached to the same body.
+            || a->body == b->body
+            // Don't collide shapes that don't pass the filter.
+            || cpShapeFilterReject(a->filter, b->filter)
+        )
+        {
+            return true;
+        }
+
+        // Don't collide bodies if they have a constraint with collideBodies == cpFalse.
+        cpBody* bodyA = a->body;
+        cpBody* bodyB = b->body;
+        CP_BODY_FOREACH_CONSTRAINT(bodyA, constraint)
+        {
+            if (!constraint->collideBodies &&
+                ((constraint->a == bodyA && constraint->b == bodyB) ||
+                 (constraint->a == bodyB && constraint->b == bodyA)))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void* StepPipeline::arbiterSetTrans(cpShape** shapes, cpSpace* space)
+    {
+        if (space->pooledArbiters->num == 0)
+        {
+            // arbiter pool is exhausted, make more
+            int count = CP_BUFFER_BYTES/sizeof(cpArbiter);
+            cpAssertHard(count, "Internal Error: Buffer size too small.");
+
+            cpArbiter* buffer = (cpArbiter*)cpcalloc(1, CP_BUFFER_BYTES);
+            cpArrayPush(space->allocatedBuffers, buffer);
+
+            for (int i = 0; i < count; i++)
+            {
+                cpArrayPush(space->pooledArbiters, buffer + i);
+            }
+        }
+
+        return cpArbiterInit((cpArbiter*)cpArrayPop(space->pooledArbiters), shapes[0], shapes[1]);
+    }
+
+    void StepPipeline::applyPair(NarrowphasePair& pair)
+    {
+        // The serial half of cpSpaceCollideShapes().
+        // Contacts move into the space's contact buffer, which is only advanced if the arbiter is kept.
+        struct cpCollisionInfo info = pair.info;
+        info.arr = cpContactBufferGetArray(_space);
+        memcpy(info.arr, pair.contacts, info.count*sizeof(struct cpContact));
+
+        // Get an arbiter from space->arbiterSet for the two shapes.
+        const cpShape* shapePair[] = { info.a, info.b };
+        cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)info.a, (cpHashValue)info.b);
+        cpArbiter* arb = (cpArbiter*)cpHashSetInsert(_space->cachedArbiters, arbHashID, shapePair,
+                                                     (cpHashSetTransFunc)arbiterSetTrans, _space);
+        cpArbiterUpdate(arb, &info, _space);
+
+        cpCollisionHandler* handler = arb->handler;
+
+        // Call the begin function first if it's the first step
+        if (arb->state == CP_ARBITER_STATE_FIRST_COLLISION && !handler->beginFunc(arb, _space, handler->userData))
+        {
+            cpArbiterIgnore(arb); // permanently ignore the collision until separation
+        }
+
+        const cpShape* a = pair.a;
+        const cpShape* b = pair.b;
+        if (
+            // Ignore the arbiter if it has been flagged
+            (arb->state != CP_ARBITER_STATE_IGNORE) &&
+            // Call preSolve
+            handler->preSolveFunc(arb, _space, handler->userData) &&
+            // Check (again) in case the pre-solve() callback called cpArbiterIgnored().
+            arb->state != CP_ARBITER_STATE_IGNORE &&
+            // Process, but don't add collisions for sensors.
+            !(a->sensor || b->sensor) &&
+            // Don't process collisions between two infinite mass bodies.
+            !(a->body->m == INFINITY && b->body->m == INFINITY)
+        )
+        {
+            cpSpacePushContacts(_space, info.count);
+            cpArrayPush(_space->arbiters, arb);
+        }
+        else
+        {
+            arb->contacts = NULL;
+            arb->count = 0;
+
+            // Normally arbiters are set as used after calling the post-solve callback.
+            // However, post-solve() callbacks are not called for sensors or arbiters rejected from pre-solve.
+            if (arb->state != CP_ARBITER_STATE_IGNORE)
+            {
+                arb->state = CP_ARBITER_STATE_NORMAL;
+            }
+        }
+
+        // Time stamp the arbiter so we know it was used recently.
+        arb->stamp = _space->stamp;
+    }
+
+    void StepPipeline::processComponents()
+    {
+        // Unlocked only while the components are processed, like cpSpaceStep(), so the space stays locked
+        // between phases of a step that is spread over several calls.
+        cpSpaceUnlock(_space, cpFalse);
+        cpSpaceProcessComponents(_space, _dt);
+        cpSpaceLock(_space);
+    }
+
+    void StepPipeline::preStep()
+    {
+        // Clear out old cached arbiters and call separate callbacks
+        cpHashSetFilter(_space->cachedArbiters, (cpHashSetFilterFunc)cpSpaceArbiterSetFilter, _space);
+
+        buildIslands();
+
+        cpArray* arbiters = _space->arbiters;
+        cpFloat dt = _dt;
+        cpFloat slop = _space->collisionSlop;
+        cpFloat biasCoef = 1.0f - cpfpow(_space->collisionBias, dt);
+        parallelFor(arbiters->num, 256, [arbiters, dt, slop, biasCoef](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            cpArbiterPreStep((cpArbiter*)arbiters->arr[i], dt, slop, biasCoef);
+                        }
+                    });
+
+        // Pre solve callbacks may touch any body, so constraints are prepared serially.
+        cpArray* constraints = _space->constraints;
+        for (int i = 0; i < constraints->num; i++)
+        {
+            cpConstraint* constraint = (cpConstraint*)constraints->arr[i];
+
+            cpConstraintPreSolveFunc preSolve = constraint->preSolve;
+            if (preSolve)
+            {
+                preSolve(constraint, _space);
+            }
+
+            constraint->klass->preStep(constraint, dt);
+        }
+    }
+
+    void StepPipeline::integrateVelocities()
+    {
+        cpArray* bodies = _space->dynamicBodies;
+        cpFloat dt = _dt;
+        cpFloat damping = cpfpow(_space->damping, dt);
+        cpVect gravity = _space->gravity;
+        parallelFor(bodies->num, 256, [bodies, gravity, damping, dt](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            cpBody* body = (cpBody*)bodies->arr[i];
+                            body->velocity_func(body, gravity, damping, dt);
+                        }
+                    });
+    }
+
+    namespace
+    {
+        /// Points an island's contacts and constraints at private copies of the static and kinematic bodies
+        /// they share with other islands while it is solved. Impulses never change bodies with infinite mass,
+        /// but islands solved at the same time would still write the same velocities to them concurrently.
+        class SharedBodyCopies
+        {
+        public:
+            SharedBodyCopies(cpArbiter** arbiters, int arbiterCount, cpConstraint** constraints, int constraintCount,
+                             bool enabled) :
+            _arbiters(arbiters),
+            _arbiterCount(enabled ? arbiterCount : 0),
+            _constraints(constraints),
+            _constraintCount(enabled ? constraintCount : 0)
+            {
+                for (int i = 0; i < _arbiterCount; i++)
+                {
+                    collect(_arbiters[i]->body_a);
+                    collect(_arbiters[i]->body_b);
+                }
+                for (int i = 0; i < _constraintCount; i++)
+                {
+                    collect(_constraints[i]->a);
+                    collect(_constraints[i]->b);
+                }
+                if (_originals.empty())
+                {
+                    _arbiterCount = _constraintCount = 0;
+                    return;
+                }
+                // Copied after collecting so the addresses of the copies stay put.
+                _copies.resize(_originals.size());
+                for (size_t i = 0; i < _originals.size(); i++)
+                {
+                    _copies[i] = *_originals[i];
+                }
+                for (int i = 0; i < _arbiterCount; i++)
+                {
+                    _arbiters[i]->body_a = copyOf(_arbiters[i]->body_a);
+                    _arbiters[i]->body_b = copyOf(_arbiters[i]->body_b);
+                }
+                for (int i = 0; i < _constraintCount; i++)
+                {
+                    _constraints[i]->a = copyOf(_constraints[i]->a);
+                    _constraints[i]->b = copyOf(_constraints[i]->b);
+                }
+            }
+
+            ~SharedBodyCopies()
+            {
+                for (int i = 0; i < _arbiterCount; i++)
+                {
+                    _arbiters[i]->body_a = originalOf(_arbiters[i]->body_a);
+                    _arbiters[i]->body_b = originalOf(_arbiters[i]->body_b);
+                }
+                for (int i = 0; i < _constraintCount; i++)
+                {
+                    _constraints[i]->a = originalOf(_constraints[i]->a);
+                    _constraints[i]->b = originalOf(_constraints[i]->b);
+                }
+            }
+
+        private:
+            void collect(cpBody* body)
+            {
+                if (cpBodyGetType(body) != CP_BODY_TYPE_DYNAMIC &&
+                    std::find(_originals.begin(), _originals.end(), body) == _originals.end())
+                {
+                    _originals.push_back(body);
+                }
+            }
+
+            cpBody* copyOf(cpBody* body)
+            {
+                auto found = std::find(_originals.begin(), _originals.end(), body);
+                return found == _originals.end() ? body : &_copies[found - _originals.begin()];
+            }
+
+            cpBody* originalOf(cpBody* body)
+            {
+                for (size_t i = 0; i < _copies.size(); i++)
+                {
+                    if (body == &_copies[i])
+                    {
+                        return _originals[i];
+                    }
+                }
+                return body;
+            }
+
+            cpArbiter** _arbiters;
+            int _arbiterCount;
+            cpConstraint** _constraints;
+            int _constraintCount;
+            std::vector<cpBody*> _originals;
+            std::vector<cpBody> _copies;
+        };
+    }
+
+    void StepPipeline::applyCachedImpulses()
+    {
+        cpFloat dtCoef = (_prevDt == 0.0f ? 0.0f : _dt/_prevDt);
+        bool concurrent = _scheduler && _islands.size() > 1;
+        parallelFor(_islands.size(), islandGrain(), [this, dtCoef, concurrent](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            const Island& island = _islands[i];
+                            cpArbiter** arbiters = _islandArbiters.data() + island.arbiterStart;
+                            cpConstraint** constraints = _islandConstraints.data() + island.constraintStart;
+                            SharedBodyCopies copies(arbiters, island.arbiterCount,
+                                                    constraints, island.constraintCount, concurrent);
+                            for (int j = 0; j < island.arbiterCount; j++)
+                            {
+                                cpArbiterApplyCachedImpulse(arbiters[j], dtCoef);
+                            }
+                            for (int j = 0; j < island.constraintCount; j++)
+                            {
+                                constraints[j]->klass->applyCachedImpulse(constraints[j], dtCoef);
+                            }
+                        }
+                    });
+    }
+
+    void StepPipeline::solve(int count)
+    {
+        cpFloat dt = _dt;
+        bool concurrent = _scheduler && _islands.size() > 1;
+        parallelFor(_islands.size(), islandGrain(), [this, count, dt, concurrent](size_t begin, size_t end)
+                    {
+                        for (size_t i = begin; i < end; i++)
+                        {
+                            const Island& island = _islands[i];
+                            cpArbiter** arbiters = _islandArbiters.data() + island.arbiterStart;
+                            cpConstraint** constraints = _islandConstraints.data() + island.constraintStart;
+                            SharedBodyCopies copies(arbiters, island.arbiterCount,
+                                                    constraints, island.constraintCount, concurrent);
+                            for (int iteration = 0; iteration < count; iteration++)
+                            {
+                                for (int j = 0; j < island.arbiterCount; j++)
+                                {
+                                    cpArbiterApplyImpulse(arbiters[j]);
+                                }
+                                for (int j = 0; j < island.constraintCount; j++)
+                                {
+                                    constraints[j]->klass->applyImpulse(constraints[j], dt);
+                                }
+                            }
+                        }
+                    });
+    }
+
+    void StepPipeline::finish()
+    {
+        // Run the constraint post-solve callbacks
+        cpArray* constraints = _space->constraints;
+        for (int i = 0; i < constraints->num; i++)
+        {
+            cpConstraint* constraint = (cpConstraint*)constraints->arr[i];
+
+            cpConstraintPostSolveFunc postSolve = constraint->postSolve;
+            if (postSolve)
+            {
+                postSolve(constraint, _space);
+            }
+        }
+
+        // run the post-solve callbacks
+        cpArray* arbiters = _space->arbiters;
+        for (int i = 0; i < arbiters->num; i++)
+        {
+            cpArbiter* arb = (cpArbiter*)arbiters->arr[i];
+
+            cpCollisionHandler* handler = arb->handler;
+            handler->postSolveFunc(arb, _space, handler->userData);
+        }
+
+        cpSpaceUnlock(_space, cpTrue);
+    }
+
+    int StepPipeline::bodyIndex(cpBody* body)
+    {
+        // Static and kinematic bodies have infinite mass, impulses never change them so they don't join islands.
+        if (cpBodyGetType(body) != CP_BODY_TYPE_DYNAMIC)
+        {
+            return -1;
+        }
+        auto it = _bodyIndices.find(body);
+        if (it != _bodyIndices.end())
+        {
+            return it->second;
+        }
+        int index = static_cast<int>(_parents.size());
+        _parents.push_back(index);
+        _bodyIndices[body] = index;
+        return index;
+    }
+
+    int StepPipeline::findRoot(int index)
+    {
+        while (_parents[index] != index)
+        {
+            _parents[index] = _parents[_parents[index]];
+            index = _parents[index];
+        }
+        return index;
+    }
+
+    int StepPipeline::islandFor(cpBody* a, cpBody* b)
+    {
+        int indexA = bodyIndex(a);
+        int indexB = bodyIndex(b);
+        int root = indexA >= 0 ? findRoot(indexA) : (indexB >= 0 ? findRoot(indexB) : -1);
+        Island empty = { 0, 0, 0, 0 };
+        if (root < 0)
+        {
+            // Touches no dynamic body, so it can go on its own.
+            _islands.push_back(empty);
+            return static_cast<int>(_islands.size()) - 1;
+        }
+        if (_rootIslands[root] < 0)
+        {
+            _rootIslands[root] = static_cast<int>(_islands.size());
+            _islands.push_back(empty);
+        }
+        return _rootIslands[root];
+    }
+
+    void StepPipeline::buildIslands()
+    {
+        cpArray* arbiters = _space->arbiters;
+        cpArray* constraints = _space->constraints;
+
+        _bodyIndices.clear();
+        _parents.clear();
+        auto unite = [this](cpBody* a, cpBody* b)
+        {
+            int indexA = bodyIndex(a);
+            int indexB = bodyIndex(b);
+            if (indexA < 0 || indexB < 0)
+            {
+                return;
+            }
+            int rootA = findRoot(indexA);
+            int rootB = findRoot(indexB);
+            if (rootA != rootB)
+            {
+                _parents[std::max(rootA, rootB)] = std::min(rootA, rootB);
+            }
+        };
+        for (int i = 0; i < arbiters->num; i++)
+        {
+            cpArbiter* arb = (cpArbiter*)arbiters->arr[i];
+            unite(arb->body_a, arb->body_b);
+        }
+        for (int i = 0; i < constraints->num; i++)
+        {
+            cpConstraint* constraint = (cpConstraint*)constraints->arr[i];
+            unite(constraint->a, constraint->b);
+        }
+
+        // Number islands in order of first appearance and count their members.
+        _rootIslands.assign(_parents.size(), -1);
+        _islands.clear();
+        _arbiterIslands.resize(arbiters->num);
+        for (int i = 0; i < arbiters->num; i++)
+        {
+            cpArbiter* arb = (cpArbiter*)arbiters->arr[i];
+            int island = islandFor(arb->body_a, arb->body_b);
+            _arbiterIslands[i] = island;
+            _islands[island].arbiterCount++;
+        }
+        _constraintIslands.resize(constraints->num);
+        for (int i = 0; i < constraints->num; i++)
+        {
+            cpConstraint* constraint = (cpConstraint*)constraints->arr[i];
+            int island = islandFor(constraint->a, constraint->b);
+            _constraintIslands[i] = island;
+            _islands[island].constraintCount++;
+        }
+
+        // Lay the members out island by island, keeping the space's order inside each island.
+        int arbiterStart = 0;
+        int constraintStart = 0;
+        for (auto& island : _islands)
+        {
+            island.arbiterStart = arbiterStart;
+            island.constraintStart = constraintStart;
+            arbiterStart += island.arbiterCount;
+            constraintStart += island.constraintCount;
+            island.arbiterCount = 0;
+            island.constraintCount = 0;
+        }
+        _islandArbiters.resize(arbiters->num);
+        for (int i = 0; i < arbiters->num; i++)
+        {
+            Island& island = _islands[_arbiterIslands[i]];
+            _islandArbiters[island.arbiterStart + island.arbiterCount++] = (cpArbiter*)arbiters->arr[i];
+        }
+        _islandConstraints.resize(constraints->num);
+        for (int i = 0; i < constraints->num; i++)
+        {
+            Island& island = _islands[_constraintIslands[i]];
+            _islandConstraints[island.constraintStart + island.constraintCount++] = (cpConstraint*)constraints->arr[i];
+        }
+    }
+}
@@ -0,0 +1,267 @@
+#include "Terrain.h"
+#include "Body.h"
+#include "SegmentShape.h"
+#include "Space.h"
+#include "TaskScheduler.h"
+#include <algorithm>
+
+namespace Chipmunk
+{
+    namespace
+    {
+        struct NeighborUpdate
+        {
+            std::shared_ptr<Shape> shape;
+            cpVect prev;
+            cpVect next;
+        };
+
+        std::pair<cpFloat, cpFloat> pointKey(cpVect p)
+        {
+            return std::make_pair(p.x, p.y);
+        }
+    }
+
+    Terrain::Terrain(Space& space, std::shared_ptr<Body> body, std::shared_ptr<const TerrainBuilder> builder) :
+    _space(space),
+    _body(body),
+    _builder(builder),
+    _tiles(builder->getTileCount())
+    {
+        for (size_t t = 0; t < _tiles.size(); t++)
+        {
+            _tiles[t].bounds = builder->getTileBounds(t);
+            _tiles[t].invalid = true;
+        }
+    }
+
+    void Terrain::invalidate(cpBB area)
+    {
+        // An edited sample changes the cells around it, which may belong to the tiles next to the area.
+        cpBB bounds = _builder->getBounds();
+        cpFloat cellX = (bounds.r - bounds.l)/(_builder->getXSamples() - 1);
+        cpFloat cellY = (bounds.t - bounds.b)/(_builder->getYSamples() - 1);
+        cpBB grown = cpBBNew(area.l - cellX, area.b - cellY, area.r + cellX, area.t + cellY);
+        for (auto& tile : _tiles)
+        {
+            if (cpBBIntersects(tile.bounds, grown))
+            {
+                tile.invalid = true;
+            }
+        }
+    }
+
+    void Terrain::invalidateAll()
+    {
+        for (auto& tile : _tiles)
+        {
+            tile.invalid = true;
+        }
+    }
+
+    std::vector<std::shared_ptr<Shape>> Terrain::getShapes(size_t tile) const
+    {
+        std::vector<std::shared_ptr<Shape>> shapes;
+        for (auto& segment : _tiles[tile].segments)
+        {
+            shapes.push_back(segment.shape);
+        }
+        return shapes;
+    }
+
+    bool Terrain::onEdge(const Tile& tile, cpVect p) const
+    {
+        // Traced vertexes on a tile's edges are snapped exactly onto them.
+        return p.x == tile.bounds.l || p.x == tile.bounds.r || p.y == tile.bounds.b || p.y == tile.bounds.t;
+    }
+
+    void Terrain::unlink(size_t t, std::vector<SegmentRef>& touched)
+    {
+        std::vector<Segment>& segments = _tiles[t].segments;
+        for (size_t s = 0; s < segments.size(); s++)
+        {
+            const TerrainBuilder::Edge& edge = segments[s].edge;
+            if (onEdge(_tiles[t], edge.a))
+            {
+                auto start = _starts.find(pointKey(edge.a));
+                if (start != _starts.end() && start->second == SegmentRef(t, s))
+                {
+                    _starts.erase(start);
+                }
+                auto before = _ends.find(pointKey(edge.a));
+                if (before != _ends.end() && before->second.first != t)
+                {
+                    TerrainBuilder::Edge& other = _tiles[before->second.first].segments[before->second.second].edge;
+                    other.next = other.b;
+                    touched.push_back(before->second);
+                }
+            }
+            if (onEdge(_tiles[t], edge.b))
+            {
+                auto end = _ends.find(pointKey(edge.b));
+                if (end != _ends.end() && end->second == SegmentRef(t, s))
+                {
+                    _ends.erase(end);
+                }
+                auto after = _starts.find(pointKey(edge.b));
+                if (after != _starts.end() && after->second.first != t)
+                {
+                    TerrainBuilder::Edge& other = _tiles[after->second.first].segments[after->second.second].edge;
+                    other.prev = other.a;
+                    touched.push_back(after->second);
+                }
+            }
+        }
+    }
+
+    void Terrain::link(size_t t, std::vector<SegmentRef>& touched)
+    {
+        std::vector<Segment>& segments = _tiles[t].segments;
+        for (size_t s = 0; s < segments.size(); s++)
+        {
+            TerrainBuilder::Edge& edge = segments[s].edge;
+            if (onEdge(_tiles[t], edge.a))
+            {
+                _starts[pointKey(edge.a)] = SegmentRef(t, s);
+                auto before = _ends.find(pointKey(edge.a));
+                if (before != _ends.end() && before->second.first != t)
+                {
+                    TerrainBuilder::Edge& other = _tiles[before->second.first].segments[before->second.second].edge;
+                    edge.prev = other.a;
+                    other.next = edge.b;
+                    touched.push_back(before->second);
+                }
+            }
+            if (onEdge(_tiles[t], edge.b))
+            {
+                _ends[pointKey(edge.b)] = SegmentRef(t, s);
+                auto after = _starts.find(pointKey(edge.b));
+                if (after != _starts.end() && after->second.first != t)
+                {
+                    TerrainBuilder::Edge& other = _tiles[after->second.first].segments[after->second.second].edge;
+                    edge.next = other.b;
+                    other.prev = edge.a;
+                    touched.push_back(after->second);
+                }
+            }
+        }
+    }
+
+    void Terrain::update()
+    {
+        std::vector<size_t> invalid;
+        for (size_t t = 0; t < _tiles.size(); t++)
+        {
+            if (_tiles[t].invalid)
+            {
+                invalid.push_back(t);
+            }
+        }
+        if (invalid.empty())
+        {
+            return;
+        }
+
+        std::vector<std::vector<TerrainBuilder::Edge>> traced(invalid.size());
+        auto traceRange = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                traced[i] = TerrainBuilder::edges(_builder->traceTile(invalid[i]));
+            }
+        };
+        const std::shared_ptr<TaskScheduler>& scheduler = _builder->getScheduler();
+        if (scheduler)
+        {
+            scheduler->parallelFor(invalid.size(), 1, traceRange);
+            scheduler->wait();
+        }
+        else
+        {
+            traceRange(0, invalid.size());
+        }
+
+        std::vector<SegmentRef> touched;
+        for (size_t t : invalid)
+        {
+            unlink(t, touched);
+        }
+
+        // Segments traced exactly as before keep their shapes, the rest are replaced.
+        std::vector<std::shared_ptr<Shape>> removed;
+        std::vector<std::shared_ptr<Shape>> added;
+        std::vector<NeighborUpdate> updates;
+        for (size_t i = 0; i < invalid.size(); i++)
+        {
+            Tile& tile = _tiles[invalid[i]];
+            std::map<std::pair<PointKey, PointKey>, std::shared_ptr<Shape>> previous;
+            for (auto& segment : tile.segments)
+            {
+                if (!previous.emplace(std::make_pair(pointKey(segment.edge.a), pointKey(segment.edge.b)),
+                                      segment.shape).second)
+                {
+                    removed.push_back(segment.shape);
+                }
+            }
+            std::vector<Segment> segments(traced[i].size());
+            for (size_t s = 0; s < segments.size(); s++)
+            {
+                segments[s].edge = traced[i][s];
+                auto found = previous.find(std::make_pair(pointKey(segments[s].edge.a), pointKey(segments[s].edge.b)));
+                if (found != previous.end())
+                {
+                    segments[s].shape = found->second;
+                    previous.erase(found);
+                }
+            }
+            for (auto& leftover : previous)
+            {
+                removed.push_back(leftover.second);
+            }
+            tile.segments.swap(segments);
+            tile.invalid = false;
+        }
+
+        for (size_t t : invalid)
+        {
+            link(t, touched);
+        }
+
+        std::vector<bool> retraced(_tiles.size(), false);
+        for (size_t t : invalid)
+        {
+            retraced[t] = true;
+            for (auto& segment : _tiles[t].segments)
+            {
+                const TerrainBuilder::Edge& edge = segment.edge;
+                if (segment.shape)
+                {
+                    updates.push_back({ segment.shape, edge.prev, edge.next });
+                    continue;
+                }
+                segment.shape = std::make_shared<SegmentShape>(_body, edge.a, edge.b, _builder->getRadius());
+                cpSegmentShapeSetNeighbors(*segment.shape, edge.prev, edge.next);
+                added.push_back(segment.shape);
+            }
+        }
+        // Segments of untouched tiles whose neighbour on the other side of a tile edge changed.
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (auto& ref : touched)
+        {
+            if (!retraced[ref.first])
+            {
+                const Segment& segment = _tiles[ref.first].segments[ref.second];
+                updates.push_back({ segment.shape, segment.edge.prev, segment.edge.next });
+            }
+        }
+
+        _space.enqueue([removed, added, updates](Space& space) {
+            space.remove(removed);
+            for (auto& update : updates)
+            {
+                cpSegmentShapeSetNeighbors(*update.shape, update.prev, update.next);
+            }
+            space.add(added);
+        });
+    }
+}
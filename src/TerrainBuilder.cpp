@@ -0,0 +1,350 @@
+#include "TerrainBuilder.h"
+#include "Body.h"
+#include "SegmentShape.h"
+#include "TaskScheduler.h"
+extern "C" {
+#include <cpPolyline.h>
+#include <cpMarch.h>
+}
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace Chipmunk
+{
+    namespace
+    {
+        struct PointHash
+        {
+            size_t operator()(const cpVect& v) const
+            {
+                std::hash<cpFloat> hash;
+                return hash(v.x)*31 ^ hash(v.y);
+            }
+        };
+
+        struct PointEqual
+        {
+            bool operator()(const cpVect& a, const cpVect& b) const
+            {
+                return a.x == b.x && a.y == b.y;
+            }
+        };
+
+        bool isClosed(const std::vector<cpVect>& line)
+        {
+            return line.size() > 2 && PointEqual()(line.front(), line.back());
+        }
+
+        /// Join polylines where one ends exactly where another starts, marching squares keeps them all oriented alike.
+        std::vector<std::vector<cpVect>> joinLines(std::vector<std::vector<cpVect>>& lines)
+        {
+            const size_t none = static_cast<size_t>(-1);
+            std::unordered_map<cpVect, size_t, PointHash, PointEqual> starts;
+            for (size_t i = 0; i < lines.size(); i++)
+            {
+                if (!isClosed(lines[i]))
+                {
+                    starts.emplace(lines[i].front(), i);
+                }
+            }
+            std::vector<size_t> next(lines.size(), none);
+            std::vector<bool> hasPrev(lines.size(), false);
+            for (size_t i = 0; i < lines.size(); i++)
+            {
+                if (isClosed(lines[i]))
+                {
+                    continue;
+                }
+                auto found = starts.find(lines[i].back());
+                if (found != starts.end() && found->second != i && !hasPrev[found->second])
+                {
+                    next[i] = found->second;
+                    hasPrev[found->second] = true;
+                }
+            }
+
+            std::vector<std::vector<cpVect>> joined;
+            std::vector<bool> used(lines.size(), false);
+            auto chain = [&](size_t first) {
+                std::vector<cpVect> line;
+                line.swap(lines[first]);
+                used[first] = true;
+                for (size_t k = next[first]; k != none && !used[k]; k = next[k])
+                {
+                    line.insert(line.end(), lines[k].begin() + 1, lines[k].end());
+                    used[k] = true;
+                }
+                joined.push_back(std::vector<cpVect>());
+                joined.back().swap(line);
+            };
+            // Open chains start at lines nothing leads into, whatever is left over are loops.
+            for (size_t i = 0; i < lines.size(); i++)
+            {
+                if (!used[i] && (isClosed(lines[i]) || !hasPrev[i]))
+                {
+                    chain(i);
+                }
+            }
+            for (size_t i = 0; i < lines.size(); i++)
+            {
+                if (!used[i])
+                {
+                    chain(i);
+                }
+            }
+            return joined;
+        }
+
+        cpFloat snap(cpFloat value, cpFloat lo, cpFloat hi, cpFloat epsilon)
+        {
+            if (cpfabs(value - lo) < epsilon)
+            {
+                return lo;
+            }
+            if (cpfabs(value - hi) < epsilon)
+            {
+                return hi;
+            }
+            return value;
+        }
+    }
+
+    struct TerrainBuilder::TileContext
+    {
+        const TerrainBuilder* builder;
+        cpBB bb;
+        cpFloat epsilon;
+        cpPolylineSet* lines;
+    };
+
+    TerrainBuilder::TerrainBuilder(cpBB bounds, unsigned long xSamples, unsigned long ySamples, SampleFunc sample) :
+    _bounds(bounds),
+    _xSamples(xSamples),
+    _ySamples(ySamples),
+    _sample(sample),
+    _pixels(nullptr),
+    _stride(0),
+    _threshold(0.5f),
+    _hard(false),
+    _simplifyTolerance(0.0f),
+    _radius(0.0f),
+    _tileCells(32),
+    _scheduler()
+    {
+        cpAssertHard(xSamples >= 2 && ySamples >= 2, "Terrain needs at least 2 samples along each axis.");
+    }
+
+    TerrainBuilder::TerrainBuilder(cpBB bounds, const uint8_t* pixels, unsigned long width, unsigned long height,
+                                   size_t stride) :
+    TerrainBuilder(bounds, width, height, SampleFunc())
+    {
+        _pixels = pixels;
+        _stride = stride ? stride : width;
+    }
+
+    void TerrainBuilder::setTileCells(unsigned long cells)
+    {
+        cpAssertHard(cells > 0, "Tiles need at least one cell.");
+        _tileCells = cells;
+    }
+
+    cpVect TerrainBuilder::samplePoint(unsigned long i, unsigned long j) const
+    {
+        return cpv(_bounds.l + (_bounds.r - _bounds.l)*i/(_xSamples - 1),
+                   _bounds.b + (_bounds.t - _bounds.b)*j/(_ySamples - 1));
+    }
+
+    cpFloat TerrainBuilder::sampleAt(unsigned long i, unsigned long j) const
+    {
+        if (_pixels)
+        {
+            return _pixels[(_ySamples - 1 - j)*_stride + i]/255.0f;
+        }
+        return _sample(samplePoint(i, j));
+    }
+
+    size_t TerrainBuilder::getTileCount() const
+    {
+        size_t tilesX = (_xSamples - 1 + _tileCells - 1)/_tileCells;
+        size_t tilesY = (_ySamples - 1 + _tileCells - 1)/_tileCells;
+        return tilesX*tilesY;
+    }
+
+    void TerrainBuilder::tileRange(size_t tile, unsigned long& i0, unsigned long& j0,
+                                   unsigned long& i1, unsigned long& j1) const
+    {
+        size_t tilesX = (_xSamples - 1 + _tileCells - 1)/_tileCells;
+        i0 = static_cast<unsigned long>(tile%tilesX)*_tileCells;
+        j0 = static_cast<unsigned long>(tile/tilesX)*_tileCells;
+        i1 = std::min(i0 + _tileCells, _xSamples - 1);
+        j1 = std::min(j0 + _tileCells, _ySamples - 1);
+    }
+
+    cpBB TerrainBuilder::getTileBounds(size_t tile) const
+    {
+        unsigned long i0, j0, i1, j1;
+        tileRange(tile, i0, j0, i1, j1);
+        cpVect min = samplePoint(i0, j0);
+        cpVect max = samplePoint(i1, j1);
+        return cpBBNew(min.x, min.y, max.x, max.y);
+    }
+
+    cpFloat TerrainBuilder::marchSample(cpVect point, void* data)
+    {
+        // Neighbouring tiles compute the points on their shared edge slightly differently, so every point is mapped
+        // back to its grid sample to give both tiles exactly the same densities.
+        const TerrainBuilder* builder = static_cast<TileContext*>(data)->builder;
+        cpBB bounds = builder->_bounds;
+        cpFloat i = std::round((point.x - bounds.l)/(bounds.r - bounds.l)*(builder->_xSamples - 1));
+        cpFloat j = std::round((point.y - bounds.b)/(bounds.t - bounds.b)*(builder->_ySamples - 1));
+        return builder->sampleAt(static_cast<unsigned long>(cpfclamp(i, 0.0f, builder->_xSamples - 1)),
+                                 static_cast<unsigned long>(cpfclamp(j, 0.0f, builder->_ySamples - 1)));
+    }
+
+    void TerrainBuilder::marchSegment(cpVect a, cpVect b, void* data)
+    {
+        // Put vertexes on the tile's edges exactly on them so they match the neighbouring tile's.
+        TileContext* context = static_cast<TileContext*>(data);
+        cpBB bb = context->bb;
+        cpFloat epsilon = context->epsilon;
+        a = cpv(snap(a.x, bb.l, bb.r, epsilon), snap(a.y, bb.b, bb.t, epsilon));
+        b = cpv(snap(b.x, bb.l, bb.r, epsilon), snap(b.y, bb.b, bb.t, epsilon));
+        if (!PointEqual()(a, b))
+        {
+            cpPolylineSetCollectSegment(a, b, context->lines);
+        }
+    }
+
+    void TerrainBuilder::marchTile(size_t tile, std::vector<std::vector<cpVect>>& lines) const
+    {
+        unsigned long i0, j0, i1, j1;
+        tileRange(tile, i0, j0, i1, j1);
+        cpFloat cell = cpfmin((_bounds.r - _bounds.l)/(_xSamples - 1), (_bounds.t - _bounds.b)/(_ySamples - 1));
+        TileContext context = { this, getTileBounds(tile), 1e-4f*cell, cpPolylineSetNew() };
+        auto march = _hard ? cpMarchHard : cpMarchSoft;
+        march(context.bb, i1 - i0 + 1, j1 - j0 + 1, _threshold,
+              marchSegment, &context, marchSample, &context);
+
+        for (int i = 0; i < context.lines->count; i++)
+        {
+            cpPolyline* line = context.lines->lines[i];
+            lines.push_back(std::vector<cpVect>(line->verts, line->verts + line->count));
+        }
+        cpPolylineSetFree(context.lines, cpTrue);
+    }
+
+    void TerrainBuilder::simplify(std::vector<cpVect>& verts) const
+    {
+        int count = static_cast<int>(verts.size());
+        cpPolyline* line = (cpPolyline*)cpcalloc(1, sizeof(cpPolyline) + count*sizeof(cpVect));
+        line->count = count;
+        line->capacity = count;
+        std::copy(verts.begin(), verts.end(), line->verts);
+        cpPolyline* simplified = cpPolylineSimplifyCurves(line, _simplifyTolerance);
+        verts.assign(simplified->verts, simplified->verts + simplified->count);
+        cpPolylineFree(simplified);
+        cpPolylineFree(line);
+    }
+
+    std::vector<std::vector<cpVect>> TerrainBuilder::traceTile(size_t tile) const
+    {
+        std::vector<std::vector<cpVect>> lines;
+        marchTile(tile, lines);
+        if (_simplifyTolerance > 0.0f)
+        {
+            for (auto& line : lines)
+            {
+                simplify(line);
+            }
+        }
+        return lines;
+    }
+
+    std::vector<std::vector<cpVect>> TerrainBuilder::trace() const
+    {
+        size_t tiles = getTileCount();
+        std::vector<std::vector<std::vector<cpVect>>> tileLines(tiles);
+        auto traceRange = [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; tile++)
+            {
+                marchTile(tile, tileLines[tile]);
+            }
+        };
+        if (_scheduler)
+        {
+            _scheduler->parallelFor(tiles, 1, traceRange);
+            _scheduler->wait();
+        }
+        else
+        {
+            traceRange(0, tiles);
+        }
+
+        std::vector<std::vector<cpVect>> pieces;
+        for (auto& lines : tileLines)
+        {
+            for (auto& line : lines)
+            {
+                pieces.push_back(std::vector<cpVect>());
+                pieces.back().swap(line);
+            }
+        }
+        std::vector<std::vector<cpVect>> lines = joinLines(pieces);
+        if (_simplifyTolerance > 0.0f)
+        {
+            auto simplifyRange = [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                {
+                    simplify(lines[i]);
+                }
+            };
+            if (_scheduler)
+            {
+                _scheduler->parallelFor(lines.size(), 16, simplifyRange);
+                _scheduler->wait();
+            }
+            else
+            {
+                simplifyRange(0, lines.size());
+            }
+        }
+        return lines;
+    }
+
+    std::vector<TerrainBuilder::Edge> TerrainBuilder::edges(const std::vector<std::vector<cpVect>>& lines)
+    {
+        std::vector<Edge> edges;
+        for (auto& line : lines)
+        {
+            size_t count = line.size();
+            bool closed = isClosed(line);
+            for (size_t k = 0; k + 1 < count; k++)
+            {
+                Edge edge;
+                edge.a = line[k];
+                edge.b = line[k + 1];
+                if (PointEqual()(edge.a, edge.b))
+                {
+                    continue;
+                }
+                edge.prev = k > 0 ? line[k - 1] : (closed ? line[count - 2] : edge.a);
+                edge.next = k + 2 < count ? line[k + 2] : (closed ? line[1] : edge.b);
+                edges.push_back(edge);
+            }
+        }
+        return edges;
+    }
+
+    std::vector<std::shared_ptr<Shape>> TerrainBuilder::build(std::shared_ptr<Body> body) const
+    {
+        std::vector<std::shared_ptr<Shape>> shapes;
+        for (auto& edge : edges(trace()))
+        {
+            auto segment = std::make_shared<SegmentShape>(body, edge.a, edge.b, _radius);
+            cpSegmentShapeSetNeighbors(*segment, edge.prev, edge.next);
+            shapes.push_back(segment);
+        }
+        return shapes;
+    }
+}
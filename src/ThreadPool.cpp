@@ -0,0 +1,139 @@
+#include "ThreadPool.h"
+
+namespace Chipmunk
+{
+    namespace
+    {
+        /// Pool whose range the current thread is running, nested waits on it must not wait for their own range.
+        /// Waits on other pools from inside the range still wait for the loops they started.
+        thread_local const ThreadPool* runningPool = nullptr;
+    }
+
+    ThreadPool::ThreadPool(unsigned threads) :
+    _active(false),
+    _owner(std::thread::id()),
+    _count(0),
+    _grain(1),
+    _next(0),
+    _generation(0),
+    _busy(0),
+    _quit(false)
+    {
+        for (unsigned i = 1; i < threads; i++)
+        {
+            _workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+        }
+        _wake.notify_all();
+        for (auto& worker : _workers)
+        {
+            worker.join();
+        }
+    }
+
+    unsigned ThreadPool::getThreadCount() const
+    {
+        return static_cast<unsigned>(_workers.size()) + 1;
+    }
+
+    void ThreadPool::parallelFor(size_t count, size_t grain, std::function<void(size_t, size_t)> func)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (grain == 0)
+        {
+            grain = 1;
+        }
+        if (_workers.empty() || count <= grain || _active.exchange(true))
+        {
+            // Nothing to share, or the workers are already busy with another loop.
+            func(0, count);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _owner.store(std::this_thread::get_id());
+            _func = std::move(func);
+            _count = count;
+            _grain = grain;
+            _next.store(0, std::memory_order_relaxed);
+            _busy = static_cast<unsigned>(_workers.size());
+            _generation++;
+        }
+        _wake.notify_all();
+    }
+
+    void ThreadPool::wait()
+    {
+        if (runningPool == this || !_active.load() || _owner.load() != std::this_thread::get_id())
+        {
+            // Nothing was started by this thread, its loops already ran serially.
+            return;
+        }
+
+        runChunks();
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]() { return _busy == 0; });
+        _func = nullptr;
+        _owner.store(std::thread::id());
+        _active.store(false);
+    }
+
+    void ThreadPool::runChunks()
+    {
+        const ThreadPool* outer = runningPool;
+        runningPool = this;
+        while (true)
+        {
+            size_t begin = _next.fetch_add(_grain, std::memory_order_relaxed);
+            if (begin >= _count)
+            {
+                break;
+            }
+            size_t end = begin + _grain < _count ? begin + _grain : _count;
+            _func(begin, end);
+        }
+        runningPool = outer;
+    }
+
+    void ThreadPool::workerLoop()
+    {
+        unsigned seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [this, seen]() { return _quit || _generation != seen; });
+                if (_quit)
+                {
+                    return;
+                }
+                seen = _generation;
+            }
+
+            runChunks();
+
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                last = (--_busy == 0);
+            }
+            if (last)
+            {
+                _done.notify_one();
+            }
+        }
+    }
+}
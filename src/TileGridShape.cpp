@@ -0,0 +1,303 @@
+#include "TileGridShape.h"
+#include "Body.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Chipmunk
+{
+    namespace
+    {
+        struct WakeContext
+        {
+            cpShape* grid;
+            cpBB bb;
+        };
+
+        void wakeNear(cpBody*, cpArbiter* arb, void* data)
+        {
+            WakeContext* context = static_cast<WakeContext*>(data);
+            CP_ARBITER_GET_SHAPES(arb, grid, other);
+            if (grid == context->grid && cpBBIntersects(cpShapeGetBB(other), context->bb))
+            {
+                cpBodyActivate(cpShapeGetBody(other));
+            }
+        }
+    }
+
+    TileGridShape::TileGridShape(std::shared_ptr<Body> body, int width, int height, cpFloat tileSize, cpVect origin) :
+    CustomShape(body),
+    _width(width),
+    _height(height),
+    _tileSize(tileSize),
+    _origin(origin),
+    _tiles(static_cast<size_t>(width)*height, 0)
+    {
+        cpAssertHard(width > 0 && height > 0, "A tile grid needs at least one tile.");
+        cpAssertHard(tileSize > 0.0f, "Tile size must be positive.");
+    }
+
+    std::shared_ptr<Shape> TileGridShape::clone(std::shared_ptr<Body> body) const
+    {
+        auto shape = std::make_shared<TileGridShape>(body, _width, _height, _tileSize, _origin);
+        shape->_tiles = _tiles;
+        copyProperties(*shape);
+        return shape;
+    }
+
+    uint8_t TileGridShape::getTile(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= _width || y >= _height)
+        {
+            return 0;
+        }
+        return _tiles[static_cast<size_t>(y)*_width + x];
+    }
+
+    bool TileGridShape::isSolid(int x, int y) const
+    {
+        return getTile(x, y) != 0;
+    }
+
+    void TileGridShape::setTile(int x, int y, uint8_t material)
+    {
+        cpAssertHard(x >= 0 && y >= 0 && x < _width && y < _height, "Tile coordinates are outside the grid.");
+        _tiles[static_cast<size_t>(y)*_width + x] = material;
+
+        cpBody* body = cpShapeGetBody(_shape);
+        if (!cpShapeGetSpace(_shape) || !body)
+        {
+            return;
+        }
+        if (cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC)
+        {
+            cpBodyActivate(body);
+            return;
+        }
+        // The whole grid is one shape, so only wake bodies touching the grid near the changed tile
+        // instead of everything on the map like cpBodyActivateStatic() would.
+        cpFloat margin = 0.5f*_tileSize;
+        cpFloat l = _origin.x + x*_tileSize;
+        cpFloat b = _origin.y + y*_tileSize;
+        cpBB local = cpBBNew(l - margin, b - margin, l + _tileSize + margin, b + _tileSize + margin);
+        cpTransform transform = cpTransformRigid(cpBodyGetPosition(body), cpBodyGetAngle(body));
+        WakeContext context = { _shape, cpTransformbBB(transform, local) };
+        cpBodyEachArbiter(body, wakeNear, &context);
+    }
+
+    uint8_t TileGridShape::getMaterialAt(cpVect point) const
+    {
+        cpVect p = cpBodyWorldToLocal(cpShapeGetBody(_shape), point);
+        return getTile(static_cast<int>(std::floor((p.x - _origin.x)/_tileSize)),
+                       static_cast<int>(std::floor((p.y - _origin.y)/_tileSize)));
+    }
+
+    int TileGridShape::columnAt(cpFloat x) const
+    {
+        cpFloat column = std::floor((x - _origin.x)/_tileSize);
+        return static_cast<int>(cpfclamp(column, 0.0f, static_cast<cpFloat>(_width - 1)));
+    }
+
+    int TileGridShape::rowAt(cpFloat y) const
+    {
+        cpFloat row = std::floor((y - _origin.y)/_tileSize);
+        return static_cast<int>(cpfclamp(row, 0.0f, static_cast<cpFloat>(_height - 1)));
+    }
+
+    void TileGridShape::boxPart(int x0, int x1, int y, Part& part) const
+    {
+        cpFloat l = _origin.x + x0*_tileSize;
+        cpFloat r = _origin.x + (x1 + 1)*_tileSize;
+        cpFloat b = _origin.y + y*_tileSize;
+        cpFloat t = b + _tileSize;
+        part.id = static_cast<cpHashValue>(y)*_width + x0;
+        part.count = 4;
+        part.verts[0] = cpv(l, b);
+        part.verts[1] = cpv(r, b);
+        part.verts[2] = cpv(r, t);
+        part.verts[3] = cpv(l, t);
+        part.radius = 0.0f;
+        part.hasNeighbors = false;
+        part.prev = cpvzero;
+        part.next = cpvzero;
+    }
+
+    cpBB TileGridShape::localBounds() const
+    {
+        return cpBBNew(_origin.x, _origin.y, _origin.x + _width*_tileSize, _origin.y + _height*_tileSize);
+    }
+
+    void TileGridShape::localParts(cpBB bb, std::vector<Part>& parts) const
+    {
+        if (!cpBBIntersects(bb, localBounds()))
+        {
+            return;
+        }
+        int left = columnAt(bb.l);
+        int right = columnAt(bb.r);
+        int bottom = rowAt(bb.b);
+        int top = rowAt(bb.t);
+        // Runs reach one tile past the box so their cut off ends are never close enough to be touched.
+        int minColumn = std::max(left - 1, 0);
+        int maxColumn = std::min(right + 1, _width - 1);
+        for (int y = bottom; y <= top; y++)
+        {
+            for (int x = left; x <= right; x++)
+            {
+                if (!isSolid(x, y))
+                {
+                    continue;
+                }
+                int x0 = x;
+                while (x0 > minColumn && isSolid(x0 - 1, y))
+                {
+                    x0--;
+                }
+                int x1 = x;
+                while (x1 < maxColumn && isSolid(x1 + 1, y))
+                {
+                    x1++;
+                }
+                // Key the part on where the run really starts, not where the box cut it off, so its contacts
+                // keep being warm started while a shape slides along it.
+                int first = x0;
+                while (first > 0 && isSolid(first - 1, y))
+                {
+                    first--;
+                }
+                parts.push_back(Part());
+                boxPart(x0, x1, y, parts.back());
+                parts.back().id = static_cast<cpHashValue>(y)*_width + first;
+                x = x1;
+            }
+        }
+    }
+
+    bool TileGridShape::localSegmentQuery(cpVect a, cpVect b, cpFloat radius, cpSegmentQueryInfo* info) const
+    {
+        if (radius > 0.0f)
+        {
+            return CustomShape::localSegmentQuery(a, b, radius, info);
+        }
+
+        // Clip the segment to the grid.
+        cpVect d = cpvsub(b, a);
+        cpBB bounds = localBounds();
+        cpFloat enter = 0.0f;
+        cpFloat exit = 1.0f;
+        cpVect enterNormal = cpvzero;
+        const cpFloat lo[] = { bounds.l, bounds.b };
+        const cpFloat hi[] = { bounds.r, bounds.t };
+        const cpFloat start[] = { a.x, a.y };
+        const cpFloat dir[] = { d.x, d.y };
+        for (int axis = 0; axis < 2; axis++)
+        {
+            if (dir[axis] == 0.0f)
+            {
+                if (start[axis] < lo[axis] || start[axis] > hi[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+            cpFloat t0 = (lo[axis] - start[axis])/dir[axis];
+            cpFloat t1 = (hi[axis] - start[axis])/dir[axis];
+            cpFloat side = -1.0f;
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+                side = 1.0f;
+            }
+            if (t0 > enter)
+            {
+                enter = t0;
+                enterNormal = axis == 0 ? cpv(side, 0.0f) : cpv(0.0f, side);
+            }
+            exit = cpfmin(exit, t1);
+        }
+        if (enter > exit)
+        {
+            return false;
+        }
+
+        // Step from tile to tile along the segment (Amanatides and Woo).
+        cpVect p = cpvadd(a, cpvmult(d, enter));
+        int x = columnAt(p.x);
+        int y = rowAt(p.y);
+        int stepX = d.x > 0.0f ? 1 : (d.x < 0.0f ? -1 : 0);
+        int stepY = d.y > 0.0f ? 1 : (d.y < 0.0f ? -1 : 0);
+        cpFloat nextX = stepX ? (_origin.x + (x + (stepX > 0))*_tileSize - a.x)/d.x : INFINITY;
+        cpFloat nextY = stepY ? (_origin.y + (y + (stepY > 0))*_tileSize - a.y)/d.y : INFINITY;
+        cpFloat deltaX = stepX ? _tileSize/cpfabs(d.x) : INFINITY;
+        cpFloat deltaY = stepY ? _tileSize/cpfabs(d.y) : INFINITY;
+
+        cpFloat t = enter;
+        cpVect normal = enterNormal;
+        while (true)
+        {
+            if (isSolid(x, y))
+            {
+                cpSegmentQueryInfo hit = { nullptr, cpvadd(a, cpvmult(d, t)), normal, t };
+                *info = hit;
+                return true;
+            }
+
+            if (nextX < nextY)
+            {
+                t = nextX;
+                x += stepX;
+                nextX += deltaX;
+                normal = cpv(-stepX, 0.0f);
+            }
+            else
+            {
+                t = nextY;
+                y += stepY;
+                nextY += deltaY;
+                normal = cpv(0.0f, -stepY);
+            }
+            if (t > exit || x < 0 || y < 0 || x >= _width || y >= _height)
+            {
+                return false;
+            }
+        }
+    }
+
+    void TileGridShape::localPointQuery(cpVect p, cpPointQueryInfo* info) const
+    {
+        // Search square rings of tiles around the point until a ring is further away than the nearest tile found.
+        int cx = static_cast<int>(std::floor((p.x - _origin.x)/_tileSize));
+        int cy = static_cast<int>(std::floor((p.y - _origin.y)/_tileSize));
+        int firstRing = std::max(std::max(-cx, cx - (_width - 1)), std::max(-cy, cy - (_height - 1)));
+        int lastRing = std::max(std::max(std::abs(cx), std::abs(cx - (_width - 1))),
+                                std::max(std::abs(cy), std::abs(cy - (_height - 1))));
+        Part part;
+        for (int ring = std::max(firstRing, 0); ring <= lastRing; ring++)
+        {
+            if ((ring - 1)*_tileSize > info->distance)
+            {
+                break;
+            }
+            for (int y = std::max(cy - ring, 0); y <= std::min(cy + ring, _height - 1); y++)
+            {
+                bool edgeRow = (y == cy - ring || y == cy + ring);
+                for (int x = cx - ring; x <= cx + ring; x += (edgeRow ? 1 : 2*ring))
+                {
+                    if (isSolid(x, y))
+                    {
+                        cpPointQueryInfo nearest;
+                        boxPart(x, x, y, part);
+                        partPointQuery(part, p, &nearest);
+                        if (nearest.distance < info->distance)
+                        {
+                            *info = nearest;
+                        }
+                    }
+                    if (ring == 0)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}